@@ -26,11 +26,27 @@
 #include <err.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <usb.h>
 
 #include "usbmisc.h"
 #include "usbext.h"
+#include "usbdesc.h"
+#include "usbevent.h"
+#include "usbhub.h"
+#include "usbids.h"
+#include "usblock.h"
+#include "usbpool.h"
+#include "usbsnap.h"
+#include "usbstat.h"
+#include "usbsysfs.h"
 
 
 const char *argp_program_version = "$Id$";
@@ -39,24 +55,60 @@ const char *argp_program_bug_address = "<jocke()vmlinux!org>";
 static char doc[] =
   "short program to show the use of argp\nThis program does little";
 
-static char args_doc[] = "[SHOW|RESET|STATUS]";
+static char args_doc[] = "[SHOW|RESET|STATUS|POWER|SAVE|IDS|PROBE-INT|BENCH-CTRL|MONITOR|JOURNAL|PIPE|PORTS|AUDIT|RECOVER]";
 
 /* initialise an argp_option struct with the options we except */
 static struct argp_option options[] =
   {
     {"verbose", 'v', 0,           0, "Produce verbose output" },
-    {"device",  'D', "PATH",      0, "Operate on this device, /proc/bus/usb/BBB/DDD ,instead of $DEVICE" },
+    {"quiet",   'q', 0,           0, "Produce less output" },
+    {"parsable", 'p', 0,          0, "SHOW: one key=value line per endpoint, with its theoretical throughput" },
+    {"jobs",    'j', "NUM",       0, "Query up to NUM devices in parallel, default 8" },
+    {"altsetting", 'A', "auto|NUM", 0, "PROBE-INT, PIPE: alternate setting to claim, auto picks the most periodic bandwidth the bus has room for" },
+    {"bandwidth", 'B', "BYTES",   0, "With --altsetting auto, the least periodic bandwidth per second that reaches BYTES" },
+    {"wait",    'w', "MS",        0, "Wait at most MS for a device claimed by another usbctl, default 10000, -1 forever" },
+    {"device",  'D', "PATH",      0, "Operate on this device, /proc/bus/usb/BBB/DDD or its sysfs directory, instead of $DEVICE" },
     {"find",    'd', "VID[/PID]", 0, "Operate on a list of devices matching VendorID/DeviceID"},
+    {"snapshot", 'S', "FILE",     0, "SAVE: write matched devices to FILE, SHOW: read devices from FILE" },
+    {"ids",     'I', "FILE",      0, "Name index to use, default " USB_IDS_INDEX },
+    {"usb-ids", 'u', "FILE",      0, "IDS: compile this usb.ids into the name index, default " USB_IDS_SOURCE },
+    {"endpoint", 'e', "EP",       0, "Endpoint address to use, e.g. 0x81" },
+    {"count",   'n', "NUM",       0, "Number of transfers to run, default 1000" },
+    {"queue",   'Q', "NUM",       0, "Number of transfers kept in flight, default 4, BENCH-CTRL: 1 for back to back requests" },
+    {"out",     'o', "EP",        0, "PIPE: bulk OUT endpoint to send stdin to" },
+    {"in",      'i', "EP",        0, "PIPE: bulk IN endpoint to copy to stdout" },
+    {"size",    'b', "BYTES",     0, "PIPE: bytes per transfer, default 16384" },
+    {"timeout", 't', "MS",        0, "PIPE: stop reading after MS without data, default 1000 once stdin is at EOF, never with --in only" },
+    {"request", 'r', "TYPE,REQ,VAL,IDX,LEN", 0, "BENCH-CTRL: control request, default GET_STATUS 0x80,0,0,0,2" },
+    {"journal", 'J', "FILE",      0, "MONITOR: hotplug event journal, default " USB_JOURNAL_FILE ", \"\" for none" },
+    {"power",   'P', "on|auto",   0, "POWER: set runtime PM policy, on pins the device awake"},
+    {"autosuspend", 'a', "MS",    0, "POWER: set autosuspend delay"},
+    {"lpm",     'l', "on|off",    0, "POWER: enable or disable link power management (LPM/U1/U2)"},
+    {"measure", 'm', 0,           0, "POWER: measure resume-from-suspend latency"},
     { 0 }
   };
 
+/* Claim interfaces as they are, without selecting a setting */
+#define ALTSETTING_DEFAULT -2
+
 /* Used by `main' to communicate with `parse_opt'. */
 struct arguments
 {
       char *cmd[1];
-      int silent, verbose;
+      int silent, verbose, parsable;
+      int jobs;
       int vid, pid;
       char *path;
+      char *snapshot;
+      char *ids, *usbids;
+      char *journal;
+      char *power;
+      int autosuspend, lpm, measure;
+      int endpoint, count, queue;
+      int out, in, size, timeout;
+      int altsetting;
+      double bandwidth;
+      int rtype, request, value, index, length;
 };
 
 /* Parse a single option. */
@@ -74,6 +126,27 @@ parse_opt (int key, char *arg, struct argp_state *state)
          args->silent = 1;
          break;
 
+      case 'p':
+         args->parsable = 1;
+         break;
+
+      case 'w':
+         usb_lock_timeout = atoi (arg);
+         break;
+
+      case 'A':
+         if (!strcasecmp (arg, "auto"))
+            args->altsetting = USB_ALTSETTING_AUTO;
+         else
+            args->altsetting = atoi (arg);
+         break;
+
+      case 'B':
+         args->bandwidth = atof (arg);
+         if (args->altsetting == ALTSETTING_DEFAULT)
+            args->altsetting = USB_ALTSETTING_AUTO;
+         break;
+
       case 'v':
          args->verbose ++;
          usb_set_debug (args->verbose);
@@ -119,10 +192,96 @@ parse_opt (int key, char *arg, struct argp_state *state)
 #endif
          break;
 
+      case 'j':
+         args->jobs = strtol (arg, NULL, 0);
+         if (args->jobs < 1)
+            argp_error (state, "%s is not a valid number of jobs.", arg);
+         break;
+
       case 'D':
          args->path = arg;
          break;
 
+      case 'S':
+         args->snapshot = arg;
+         break;
+
+      case 'I':
+         args->ids = arg;
+         break;
+
+      case 'u':
+         args->usbids = arg;
+         break;
+
+      case 'e':
+         args->endpoint = strtol (arg, NULL, 0);
+         break;
+
+      case 'n':
+         args->count = strtol (arg, NULL, 0);
+         if (args->count < 1)
+            argp_error (state, "%s is not a valid count.", arg);
+         break;
+
+      case 'Q':
+         args->queue = strtol (arg, NULL, 0);
+         if (args->queue < 1)
+            argp_error (state, "%s is not a valid queue depth.", arg);
+         break;
+
+      case 'o':
+         args->out = strtol (arg, NULL, 0);
+         break;
+
+      case 'i':
+         args->in = strtol (arg, NULL, 0);
+         break;
+
+      case 'b':
+         args->size = strtol (arg, NULL, 0);
+         if (args->size < 1)
+            argp_error (state, "%s is not a valid transfer size.", arg);
+         break;
+
+      case 't':
+         args->timeout = strtol (arg, NULL, 0);
+         break;
+
+      case 'r':
+         if (5 != sscanf (arg, "%i,%i,%i,%i,%i", &args->rtype, &args->request,
+                          &args->value, &args->index, &args->length)
+             || args->length < 0 || args->length > 4096)
+            argp_error (state, "%s is not a valid control request.", arg);
+         break;
+
+      case 'J':
+         args->journal = arg;
+         break;
+
+      case 'P':
+         if (strcmp (arg, "on") && strcmp (arg, "auto"))
+            argp_error (state, "%s is not a valid power policy, use on or auto.", arg);
+         args->power = arg;
+         break;
+
+      case 'a':
+         args->autosuspend = strtol (arg, NULL, 0);
+         break;
+
+      case 'l':
+         if (!strcmp (arg, "on"))
+            args->lpm = 1;
+         else if (!strcmp (arg, "off"))
+            args->lpm = 0;
+         else
+            argp_error (state, "%s is not a valid LPM setting, use on or off.", arg);
+         break;
+
+      case 'm':
+         args->measure = 1;
+         break;
+
       case ARGP_KEY_ARG:
          if (state->arg_num >= 1)
             /* Too many arguments. */
@@ -146,88 +305,113 @@ parse_opt (int key, char *arg, struct argp_state *state)
    return 0;
 }
 
-void print_endpoint(struct usb_endpoint_descriptor *endpoint)
+void print_endpoint(FILE *fp, struct usb_endpoint_descriptor *endpoint, int speed)
 {
+   struct usb_ss_companion comp;
    static const char *typeattr[] = { "Control", "Isochronous", "Bulk", "Interrupt" };
    static const char *syncattr[] = { "None", "Asynchronous", "Adaptive", "Synchronous" };
    static const char *usage[] = { "Data", "Feedback", "Implicit feedback Data", "(reserved)" };
    static const char *hb[] = { "1x", "2x", "3x", "(?\?)" };
 
-   printf ("    Endpoint Descriptor EP%u%s\n",
-           endpoint->bEndpointAddress & 0x0f,
-           (endpoint->bEndpointAddress & 0x80) ? "IN" : "OUT");
-   printf ("      bLength:          %5u\n", endpoint->bLength);
-   printf ("      bDescriptorType:  %5u\n", endpoint->bDescriptorType);
-   printf ("      bEndpointAddress:  0x%02X EP%u %s\n",
-           endpoint->bEndpointAddress,
-           endpoint->bEndpointAddress & 0x0f,
-           (endpoint->bEndpointAddress & 0x80) ? "IN" : "OUT");
-   printf ("      bmAttributes:      0x%02X\n"
-           "        Transfer Type:      %s\n"
-           "        Synch Type:         %s\n"
-           "        Usage Type:         %s\n",
-           endpoint->bmAttributes,
-           typeattr[endpoint->bmAttributes & 3],
-           syncattr[(endpoint->bmAttributes >> 2) & 3],
-           usage[(endpoint->bmAttributes >> 4) & 3]);
-   printf ("      wMaxPacketSize:  0x%04X %s %d bytes\n",
-           endpoint->wMaxPacketSize,
-           hb[(endpoint->wMaxPacketSize >> 11) & 3],
-           endpoint->wMaxPacketSize & 0x3ff);
-   printf ("      bInterval:        %5u ms\n", endpoint->bInterval);
+   fprintf (fp, "    Endpoint Descriptor EP%u%s\n",
+            endpoint->bEndpointAddress & 0x0f,
+            (endpoint->bEndpointAddress & 0x80) ? "IN" : "OUT");
+   fprintf (fp, "      bLength:          %5u\n", endpoint->bLength);
+   fprintf (fp, "      bDescriptorType:  %5u\n", endpoint->bDescriptorType);
+   fprintf (fp, "      bEndpointAddress:  0x%02X EP%u %s\n",
+            endpoint->bEndpointAddress,
+            endpoint->bEndpointAddress & 0x0f,
+            (endpoint->bEndpointAddress & 0x80) ? "IN" : "OUT");
+   fprintf (fp, "      bmAttributes:      0x%02X\n"
+                "        Transfer Type:      %s\n"
+                "        Synch Type:         %s\n"
+                "        Usage Type:         %s\n",
+            endpoint->bmAttributes,
+            typeattr[endpoint->bmAttributes & 3],
+            syncattr[(endpoint->bmAttributes >> 2) & 3],
+            usage[(endpoint->bmAttributes >> 4) & 3]);
+   fprintf (fp, "      wMaxPacketSize:  0x%04X %s %d bytes\n",
+            endpoint->wMaxPacketSize,
+            hb[(endpoint->wMaxPacketSize >> 11) & 3],
+            endpoint->wMaxPacketSize & 0x3ff);
+   fprintf (fp, "      bInterval:        %5u ms\n", endpoint->bInterval);
 
    /* only for audio endpoints */
    if (endpoint->bLength == 9)
    {
-      printf ("      bRefresh:         %5u\n", endpoint->bRefresh);
-      printf ("      bSynchAddress:    %5u\n", endpoint->bSynchAddress);
+      fprintf (fp, "      bRefresh:         %5u\n", endpoint->bRefresh);
+      fprintf (fp, "      bSynchAddress:    %5u\n", endpoint->bSynchAddress);
+   }
+
+   if (usb_endpoint_companion (endpoint, &comp))
+   {
+      fprintf (fp, "      SuperSpeed Endpoint Companion\n");
+      fprintf (fp, "        bMaxBurst:        %5u\n", comp.bMaxBurst);
+      if (ENDPOINT_TYPE(endpoint) == USB_ENDPOINT_TYPE_BULK)
+         fprintf (fp, "        MaxStreams:       %5u\n",
+                  SS_COMP_STREAMS(&comp) ? 1 << SS_COMP_STREAMS(&comp) : 0);
+      else if (ENDPOINT_TYPE(endpoint) == USB_ENDPOINT_TYPE_ISOCHRONOUS)
+         fprintf (fp, "        Mult:             %5u\n", SS_COMP_MULT(&comp));
+      fprintf (fp, "        wBytesPerInterval:%5u\n", comp.wBytesPerInterval);
+      if (SS_COMP_SSP_ISO(&comp))
+         fprintf (fp, "        dwBytesPerInterval: %u\n", comp.dwBytesPerInterval);
    }
+
+   if (speed)
+      fprintf (fp, "      Throughput:    %8.3f MB/s at %d Mbit/s\n",
+               usb_endpoint_throughput (endpoint, &comp, speed) / 1e6, speed);
 }
 
-void print_altsetting(struct usb_interface_descriptor *interface)
+void print_altsetting(FILE *fp, struct usb_interface_descriptor *interface, int speed)
 {
   int i;
 
-  printf("    bInterfaceNumber:   %5u\n", interface->bInterfaceNumber);
-  printf("    bAlternateSetting:  %5u\n", interface->bAlternateSetting);
-  printf("    bInterfaceClass:    %5u\n", interface->bInterfaceClass);
-  printf("    bInterfaceSubClass: %5u\n", interface->bInterfaceSubClass);
-  printf("    bInterfaceProtocol: %5u\n", interface->bInterfaceProtocol);
-  printf("    iInterface:         %5u\n", interface->iInterface);
-  printf("    bNumEndpoints:      %5u\n", interface->bNumEndpoints);
+  fprintf(fp, "    bInterfaceNumber:   %5u\n", interface->bInterfaceNumber);
+  fprintf(fp, "    bAlternateSetting:  %5u\n", interface->bAlternateSetting);
+  fprintf(fp, "    bInterfaceClass:    %5u %s\n", interface->bInterfaceClass,
+          usb_ids_label(usb_ids_class(interface->bInterfaceClass)));
+  fprintf(fp, "    bInterfaceSubClass: %5u %s\n", interface->bInterfaceSubClass,
+          usb_ids_label(usb_ids_subclass(interface->bInterfaceClass,
+                                         interface->bInterfaceSubClass)));
+  fprintf(fp, "    bInterfaceProtocol: %5u %s\n", interface->bInterfaceProtocol,
+          usb_ids_label(usb_ids_protocol(interface->bInterfaceClass,
+                                         interface->bInterfaceSubClass,
+                                         interface->bInterfaceProtocol)));
+  fprintf(fp, "    iInterface:         %5u\n", interface->iInterface);
+  fprintf(fp, "    bNumEndpoints:      %5u\n", interface->bNumEndpoints);
 
   for (i = 0; i < interface->bNumEndpoints; i++)
-    print_endpoint(&interface->endpoint[i]);
+    print_endpoint(fp, &interface->endpoint[i], speed);
 }
 
-void print_interface(struct usb_interface *interface)
+void print_interface(FILE *fp, struct usb_interface *interface, int speed)
 {
   int i;
 
   for (i = 0; i < interface->num_altsetting; i++)
-    print_altsetting(&interface->altsetting[i]);
+    print_altsetting(fp, &interface->altsetting[i], speed);
 }
 
-void print_configuration(struct usb_config_descriptor *config)
+void print_configuration(FILE *fp, struct usb_config_descriptor *config, int speed)
 {
   int i;
 
-  printf("  wTotalLength:         %5u\n", config->wTotalLength);
-  printf("  bNumInterfaces:       %5u\n", config->bNumInterfaces);
-  printf("  bConfigurationValue:  %5u\n", config->bConfigurationValue);
-  printf("  iConfiguration:       %5u\n", config->iConfiguration);
-  printf("  bmAttributes:          0x%02X\n", config->bmAttributes);
+  fprintf(fp, "  wTotalLength:         %5u\n", config->wTotalLength);
+  fprintf(fp, "  bNumInterfaces:       %5u\n", config->bNumInterfaces);
+  fprintf(fp, "  bConfigurationValue:  %5u\n", config->bConfigurationValue);
+  fprintf(fp, "  iConfiguration:       %5u\n", config->iConfiguration);
+  fprintf(fp, "  bmAttributes:          0x%02X\n", config->bmAttributes);
   if (config->bmAttributes & 0x40)
-     printf("      Self Powered\n");
+     fprintf(fp, "      Self Powered\n");
   if (config->bmAttributes & 0x20)
-     printf("      Remote Wakeup\n");
-  printf("  MaxPower:             %5u mA\n", config->MaxPower * 2);
+     fprintf(fp, "      Remote Wakeup\n");
+  fprintf(fp, "  MaxPower:             %5u mA\n", config->MaxPower * 2);
 
   for (i = 0; i < config->bNumInterfaces; i++)
-    print_interface(&config->interface[i]);
+    print_interface(fp, &config->interface[i], speed);
 }
 
-int print_device_orig(struct usb_device *dev, int level, int verbose)
+int print_device_orig(FILE *fp, struct usb_device *dev, int level, int verbose)
 {
   usb_dev_handle *udev;
   char description[256];
@@ -254,15 +438,15 @@ int print_device_orig(struct usb_device *dev, int level, int verbose)
         i += ret;
      }
 
-     printf("%.*sDev #%d: %s\n", level * 2, "                    ", dev->devnum,
-            description);
+     fprintf(fp, "%.*sDev #%d: %s\n", level * 2, "                    ", dev->devnum,
+             description);
   }
   if (udev && verbose) {
     if (dev->descriptor.iSerialNumber) {
       ret = usb_get_string_simple(udev, dev->descriptor.iSerialNumber, string, sizeof(string));
       if (ret > 0)
-        printf("%.*s  - Serial Number: %s\n", level * 2,
-               "                    ", string);
+        fprintf(fp, "%.*s  - Serial Number: %s\n", level * 2,
+                "                    ", string);
     }
   }
 
@@ -271,82 +455,86 @@ int print_device_orig(struct usb_device *dev, int level, int verbose)
 
   if (verbose) {
     if (!dev->config) {
-      printf("  Couldn't retrieve descriptors\n");
+      fprintf(fp, "  Couldn't retrieve descriptors\n");
       return 0;
     }
 
     for (i = 0; i < dev->descriptor.bNumConfigurations; i++)
-      print_configuration(&dev->config[i]);
+      print_configuration(fp, &dev->config[i], USB_SPEED_UNKNOWN);
   } else {
     for (i = 0; i < dev->num_children; i++)
-       print_device_orig(dev->children[i], level + 1, verbose);
+       print_device_orig(fp, dev->children[i], level + 1, verbose);
   }
 
   return 0;
 }
 
-int print_device(struct usb_device *dev, int level, int verbose)
+int print_device(FILE *fp, struct usb_device *dev, int level, int verbose)
 {
   usb_dev_handle *udev;
   char description[256];
-  char string[256];
-  int ret, i;
+  char string[PATH_MAX + 1];
+  const char *name;
+  int ret, i, speed;
 
+  /* Names from usb.ids stand in when the device has no strings, or
+   * when it cannot be opened at all. */
   udev = usb_open(dev);
-  if (udev)
-  {
-     i = snprintf(description, sizeof(description), "ID:%04X/%04X/%04X",
-                  dev->descriptor.idVendor, dev->descriptor.idProduct,dev->descriptor.bcdDevice);
 
+  i = snprintf(description, sizeof(description), "ID:%04X/%04X/%04X",
+               dev->descriptor.idVendor, dev->descriptor.idProduct,dev->descriptor.bcdDevice);
+
+  ret = 0;
+  if (udev && dev->descriptor.iManufacturer)
      ret = usb_get_string_simple(udev, dev->descriptor.iManufacturer, string, sizeof(string));
-     if (ret > 0)
-     {
-        ret = snprintf(&description[i], sizeof(description) - i, " %s", string);
-        i += ret;
-     }
+  name = ret > 0 ? string : usb_ids_vendor(dev->descriptor.idVendor);
+  if (name)
+  {
+     ret = snprintf(&description[i], sizeof(description) - i, " %s", name);
+     i += ret;
+  }
 
+  ret = 0;
+  if (udev && dev->descriptor.iProduct)
      ret = usb_get_string_simple(udev, dev->descriptor.iProduct, string, sizeof(string));
-     if (ret > 0)
-     {
-        ret = snprintf(&description[i], sizeof(description) - i, " - %s", string);
-        i += ret;
-     }
-#if 0
-     printf("%.*sDev #%d: Bus %s Device %s %s\n", level * 2, "                    ",
-            //dev->bus ? "dev->bus->dirname" : "(NULL)", "dev->filename",
-            "BBB", "DDD",
-            dev->devnum,
-            description);
-
-     printf ("Bus: %s Device: %s Dev#%d %s\n", dev->bus->dirname, dev->filename,
-             dev->devnum,
-             description);
-#else
-     {
+  name = ret > 0 ? string : usb_ids_product(dev->descriptor.idVendor, dev->descriptor.idProduct);
+  if (name)
+  {
+     ret = snprintf(&description[i], sizeof(description) - i, " - %s", name);
+     i += ret;
+  }
+
+  string[0] = 0;
 #ifdef LIBUSB_HAS_GET_DRIVER_NP
-        char buf[64];
-        int bInterfaceNumber, result;
-
-        bInterfaceNumber = dev->config->interface->altsetting[0].bInterfaceNumber;
-        result = usb_get_driver_np(udev, bInterfaceNumber, buf, 64);
-        if (!result)
-           sprintf (string, "Driver:%s ", buf);
-        else
-           string[0] = 0;
-#else
-        string[0] = 0;
-#endif
-     }
-     printf ("%s/%s/%s Dev:%d %s%s\n", PATH_USBFS,
-             dev->bus->dirname, dev->filename,
-             dev->devnum, string, description);
-#endif
+  if (udev && dev->config)
+  {
+     char buf[64];
+     int bInterfaceNumber, result;
+
+     bInterfaceNumber = dev->config->interface->altsetting[0].bInterfaceNumber;
+     result = usb_get_driver_np(udev, bInterfaceNumber, buf, 64);
+     if (!result)
+        sprintf (string, "Driver:%s ", buf);
   }
+#endif
+  fprintf (fp, "%s/%s/%s Dev:%d %s%s\n", PATH_USBFS,
+           dev->bus->dirname, dev->filename,
+           dev->devnum, string, description);
+
   if (udev && verbose) {
      if (dev->descriptor.iSerialNumber) {
         ret = usb_get_string_simple(udev, dev->descriptor.iSerialNumber, string, sizeof(string));
         if (ret > 0)
-           printf("%.*s  Serial Number: %s\n", level * 2, "                    ", string);
+           fprintf(fp, "%.*s  Serial Number: %s\n", level * 2, "                    ", string);
+     }
+
+     /* USB 2.01 and later may describe LPM and SuperSpeed here */
+     if (dev->descriptor.bcdUSB > 0x0200) {
+        unsigned char bos[USB_BOS_SIZE];
+
+        ret = usb_get_bos(udev, bos, sizeof(bos));
+        if (ret > 0)
+           usb_bos_print(fp, bos, ret);
      }
   }
 
@@ -355,20 +543,77 @@ int print_device(struct usb_device *dev, int level, int verbose)
 
   if (verbose) {
     if (!dev->config) {
-      printf("  Couldn't retrieve descriptors\n");
+      fprintf(fp, "  Couldn't retrieve descriptors\n");
       return 0;
     }
 
+    speed = USB_SPEED_UNKNOWN;
+    if (!usb_sysfs_path(dev, string, sizeof(string)))
+       speed = usb_sysfs_speed(string);
+
     for (i = 0; i < dev->descriptor.bNumConfigurations; i++)
-       print_configuration(&dev->config[i]);
+       print_configuration(fp, &dev->config[i], speed);
   } else {
 //    for (i = 0; i < dev->num_children; i++)
-//       print_device(dev->children[i], level + 1, verbose);
+//       print_device(fp, dev->children[i], level + 1, verbose);
   }
 
   return 0;
 }
 
+/* One key=value line per endpoint, for scripts. */
+int print_device_parsable(FILE *fp, struct usb_device *dev)
+{
+  struct usb_interface_descriptor *alt;
+  struct usb_endpoint_descriptor *ep;
+  struct usb_ss_companion comp;
+  char path[PATH_MAX + 1];
+  int c, i, a, e, mult, speed = USB_SPEED_UNKNOWN;
+
+  if (!dev->config)
+     return 1;
+  if (!usb_sysfs_path(dev, path, sizeof(path)))
+     speed = usb_sysfs_speed(path);
+
+  for (c = 0; c < dev->descriptor.bNumConfigurations; c++)
+     for (i = 0; i < dev->config[c].bNumInterfaces; i++)
+        for (a = 0; a < dev->config[c].interface[i].num_altsetting; a++)
+        {
+           alt = &dev->config[c].interface[i].altsetting[a];
+           for (e = 0; e < alt->bNumEndpoints; e++)
+           {
+              ep = &alt->endpoint[e];
+              usb_endpoint_companion(ep, &comp);
+              if (!comp.present)
+                 mult = ENDPOINT_MULT(ep) + 1;
+              else if (ENDPOINT_TYPE(ep) == USB_ENDPOINT_TYPE_ISOCHRONOUS)
+                 mult = SS_COMP_MULT(&comp) + 1;
+              else
+                 mult = 1;
+              fprintf(fp, "device=%s/%s/%s vid=%04x pid=%04x speed=%d config=%u "
+                          "interface=%u alt=%u ep=0x%02x type=%s maxp=%u mult=%u "
+                          "burst=%u streams=%u bytes_per_interval=%u interval_us=%ld "
+                          "throughput=%.0f\n",
+                      PATH_USBFS, dev->bus->dirname, dev->filename,
+                      dev->descriptor.idVendor, dev->descriptor.idProduct, speed,
+                      dev->config[c].bConfigurationValue, alt->bInterfaceNumber,
+                      alt->bAlternateSetting, ep->bEndpointAddress,
+                      ENDPOINT_TYPE(ep) == USB_ENDPOINT_TYPE_ISOCHRONOUS ? "iso"
+                      : ENDPOINT_TYPE(ep) == USB_ENDPOINT_TYPE_BULK ? "bulk"
+                      : ENDPOINT_TYPE(ep) == USB_ENDPOINT_TYPE_INTERRUPT ? "int" : "ctrl",
+                      ENDPOINT_MAXP(ep),
+                      mult, comp.bMaxBurst + 1,
+                      ENDPOINT_TYPE(ep) == USB_ENDPOINT_TYPE_BULK && SS_COMP_STREAMS(&comp)
+                      ? 1 << SS_COMP_STREAMS(&comp) : 0,
+                      SS_COMP_SSP_ISO(&comp) ? comp.dwBytesPerInterval : comp.wBytesPerInterval,
+                      usb_endpoint_interval(ep, speed),
+                      usb_endpoint_throughput(ep, &comp, speed));
+           }
+        }
+
+  return 0;
+}
+
 void print_devices (int verbose)
 {
   struct usb_bus *bus;
@@ -376,12 +621,12 @@ void print_devices (int verbose)
   for (bus = usb_busses; bus; bus = bus->next)
   {
      if (bus->root_dev && !verbose)
-        print_device(bus->root_dev, 0, verbose);
+        print_device(stdout, bus->root_dev, 0, verbose);
      else {
         struct usb_device *dev;
 
         for (dev = bus->devices; dev; dev = dev->next)
-           print_device(dev, 0, verbose);
+           print_device(stdout, dev, 0, verbose);
      }
   }
 }
@@ -414,6 +659,17 @@ int list_add_clone (struct usb_device **list, struct usb_device *dev)
    return 0;
 }
 
+/* Add if VID/PID matches dev, or
+ * if VID matches dev and PID is unset, or
+ * if both VID and PID are unset.
+ */
+static int match_device (int dvid, int dpid, int vid, int pid)
+{
+   return (dvid == vid && dpid == pid)
+      || (dvid == vid && pid == 0)
+      || (vid == 0 && pid == 0);
+}
+
 struct usb_device *find_devices (int vid, int pid, int did)
 {
   struct usb_bus *bus;
@@ -430,13 +686,7 @@ struct usb_device *find_devices (int vid, int pid, int did)
 
      for (dev = bus->devices; dev; dev = dev->next)
      {
-        /* Add if VID/PID matches dev, or
-         * if VID matches dev and PID is unset, or
-         * if both VID and PID are unset.
-         */
-        if ((dev->descriptor.idVendor == vid && dev->descriptor.idProduct == pid)
-            || (dev->descriptor.idVendor == vid && pid == 0)
-            || (vid == 0 && pid == 0))
+        if (match_device (dev->descriptor.idVendor, dev->descriptor.idProduct, vid, pid))
         {
            list_add_clone (&head, dev);
         }
@@ -448,9 +698,14 @@ struct usb_device *find_devices (int vid, int pid, int did)
 
 struct usb_device *locate_device (char *path)
 {
-   struct usb_device *dev = NULL;
+   struct usb_device *dev = NULL, *found;
 
-   list_add_clone (&dev, get_usb_device (path));
+   found = get_usb_device (path);
+   if (!found)
+   {
+      errx (ENODEV, "No such device %s", path);
+   }
+   list_add_clone (&dev, found);
 
    return dev;
 }
@@ -490,6 +745,22 @@ int reset (struct usb_device *list, int verbose)
 }
 
 
+/* The device answers on its control endpoint */
+static int status_query (struct usb_dev_handle *udev)
+{
+   /* XXX - Only try this if there's actually a control ep available! */
+   return usb_control_msg(udev, USB_TYPE_VENDOR | USB_RECIP_DEVICE,
+                          USB_REQ_GET_STATUS, 0, 0, NULL, 0, 5000 );
+}
+
+/* A device that STALLs the vendor request still answers on ep0 */
+static int status_alive (struct usb_dev_handle *udev)
+{
+   int result = status_query (udev);
+
+   return result >= 0 || result == -EPIPE;
+}
+
 /* Query device status using simple control ep */
 int status (struct usb_device *list, int verbose)
 {
@@ -505,9 +776,7 @@ int status (struct usb_device *list, int verbose)
       }
       else
       {
-         /* XXX - Only try this if there's actually a control ep available! */
-         result = usb_control_msg(udev, USB_TYPE_VENDOR | USB_RECIP_DEVICE,
-                                  USB_REQ_GET_STATUS, 0, 0, NULL, 0, 5000 );
+         result = status_query (udev);
          if (result)
             printf("usb_control_msg() returned %d (%s)\n", result, usb_strerror());
 #if 0
@@ -525,133 +794,1849 @@ int status (struct usb_device *list, int verbose)
    return 0;
 }
 
-/* Display device information */
-int display (struct usb_device *list, int verbose)
+struct display_job
 {
-   while (list)
+   struct usb_device **dev;
+   char **buf;
+   size_t *len;
+   int verbose;
+};
+
+/* Render one device into its own buffer, called from the worker pool. */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t error_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A job renders into memory, printed later in list order.  If it
+ * cannot, it writes to stdout itself, one such job at a time. */
+static FILE *job_output (char **buf, size_t *len)
+{
+   FILE *fp;
+
+   fp = open_memstream (buf, len);
+   if (fp)
+      return fp;
+
+   pthread_mutex_lock (&output_lock);
+   return stdout;
+}
+
+static void job_output_done (FILE *fp)
+{
+   if (fp != stdout)
    {
-      print_device (list, 0, verbose);
-      list = list->next;
+      fclose (fp);
+      return;
    }
 
-   return 0;
+   fflush (stdout);
+   pthread_mutex_unlock (&output_lock);
 }
 
-int list_free (struct usb_device *list)
+/* usb_open() for a job.  libusb keeps a single error string, it is
+ * copied out before another job can overwrite it. */
+static struct usb_dev_handle *job_open (struct usb_device *dev, char *error, size_t len)
+{
+   struct usb_dev_handle *udev;
+
+   pthread_mutex_lock (&error_lock);
+   udev = usb_open (dev);
+   if (!udev)
+      snprintf (error, len, "%s", usb_strerror ());
+   pthread_mutex_unlock (&error_lock);
+
+   return udev;
+}
+
+static void display_one (int i, void *arg)
+{
+   struct display_job *job = arg;
+   FILE *fp;
+
+   fp = job_output (&job->buf[i], &job->len[i]);
+   print_device (fp, job->dev[i], 0, job->verbose);
+   job_output_done (fp);
+}
+
+/* Display device information.  Opening a device and reading its string
+ * descriptors is slow, so with several jobs the devices are queried in
+ * parallel and their output is printed afterwards in list order. */
+int display (struct usb_device *list, int verbose, int parsable, int jobs)
 {
+   struct display_job job;
    struct usb_device *dev;
+   int i, num = 0;
 
-   while (list)
+   /* Descriptors are already in memory, nothing to wait for. */
+   if (parsable)
    {
-      dev = list;
-      list = dev->next;
+      for (dev = list; dev; dev = dev->next)
+         print_device_parsable (stdout, dev);
 
-      free (dev);
+      return 0;
    }
 
-   return 0;
-}
+   for (dev = list; dev; dev = dev->next)
+      num++;
 
-typedef enum {DISPLAY = 0, STATUS, RESET} op_t;
+   if (jobs <= 1 || num <= 1)
+   {
+      while (list)
+      {
+         print_device (stdout, list, 0, verbose);
+         list = list->next;
+      }
 
-typedef struct {
-  char *command;
-  op_t  cmd;
-} cmd_t;
+      return 0;
+   }
 
-cmd_t command_map[] = {
-   {"DISPLAY", DISPLAY},
-   {"SHOW", DISPLAY},
-   {"STATUS", STATUS},
-   {"RESET", RESET},
-};
+   job.dev     = calloc (num, sizeof (struct usb_device *));
+   job.buf     = calloc (num, sizeof (char *));
+   job.len     = calloc (num, sizeof (size_t));
+   job.verbose = verbose;
+   if (!job.dev || !job.buf || !job.len)
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
 
-#define ARRAY_SIZE(a) sizeof((a)) / sizeof((a)[0])
+   for (i = 0, dev = list; dev; dev = dev->next)
+      job.dev[i++] = dev;
 
-int map_command_to_cmd (char *command)
+   usb_pool_run (jobs, num, display_one, &job);
+
+   for (i = 0; i < num; i++)
+   {
+      if (job.buf[i])
+         fwrite (job.buf[i], 1, job.len[i], stdout);
+      free (job.buf[i]);
+   }
+
+   free (job.dev);
+   free (job.buf);
+   free (job.len);
+
+   return 0;
+}
+
+/* Wait for power/runtime_status to reach state, at most timeout ms. */
+static int power_wait_state (const char *path, const char *state, int timeout)
 {
-  int i;
+   char buf[32];
+   struct timespec start;
 
-  for (i = 0; i < ARRAY_SIZE(command_map); i++)
-    {
-      if (!strcasecmp (command_map[i].command, command))
-        return command_map[i].cmd;
-    }
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   do
+   {
+      if (!usb_sysfs_read (path, "power/runtime_status", buf, sizeof (buf))
+          && !strcmp (buf, state))
+         return 0;
+      usleep (1000);
+   }
+   while (usb_elapsed_ms (&start) < timeout);
 
-  return -1;
+   return -1;
 }
 
+/* Let the device autosuspend, then time how long it takes to wake it
+ * up again.  The original policy is restored before returning. */
+static double power_measure_wake (const char *path)
+{
+   char control[16], delay[16];
+   struct timespec start;
+   double wake = -1;
+
+   if (usb_sysfs_read (path, "power/control", control, sizeof (control))
+       || usb_sysfs_read (path, "power/autosuspend_delay_ms", delay, sizeof (delay)))
+      return -1;
 
+   if (usb_sysfs_write (path, "power/autosuspend_delay_ms", "0")
+       || usb_sysfs_write (path, "power/control", "auto"))
+      goto restore;
 
-int main (int argc, char **argv)
+   /* Devices with drivers that hold a PM reference never suspend. */
+   if (power_wait_state (path, "suspended", 2000))
+      goto restore;
+
+   /* Writing "on" resumes the device synchronously. */
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   if (!usb_sysfs_write (path, "power/control", "on")
+       && !power_wait_state (path, "active", 2000))
+      wake = usb_elapsed_ms (&start);
+
+  restore:
+   usb_sysfs_write (path, "power/autosuspend_delay_ms", delay);
+   usb_sysfs_write (path, "power/control", control);
+
+   return wake;
+}
+
+/* USB 2.0 LPM is a device attribute.  U1/U2 are permitted per hub
+ * port, the kernel then programs both the device and the port
+ * timeouts, and keeps usb3_hardware_lpm_u1/u2 in step. */
+static int power_set_lpm (struct usb_device *dev, const char *path, int enable)
 {
-   int cmd;
-   struct usb_device *list;
-   struct arguments arg;
-   /* Our argp parser. */
-   static struct argp argp = { options, parse_opt, args_doc, doc };
+   char port[PATH_MAX + 1];
+   int result;
 
-   /* Default values. */
-   arg.silent  = 0;
-   arg.verbose = 0;
-   arg.vid     = 0;
-   arg.pid     = 0;
-   arg.path    = getenv ("DEVICE");
-   arg.cmd[0]  = "DISPLAY";
+   if (dev->descriptor.bcdUSB < 0x0300)
+      return usb_sysfs_write (path, "power/usb2_hardware_lpm", enable ? "y" : "n");
 
-   /* Parse our arguments; every option seen by `parse_opt' will
-      be reflected in `arguments'. */
-   argp_parse (&argp, argc, argv, 0, 0, &arg);
+   result = usb_sysfs_port (path, port, sizeof (port));
+   if (result)
+      return result;
 
-   usb_init();
+   return usb_sysfs_write (port, "power/usb3_lpm_permit", enable ? "u1_u2" : "0");
+}
 
-   cmd = map_command_to_cmd (arg.cmd[0]);
-   if (cmd < 0)
+/* Show, and optionally set, runtime power management policy */
+int power (struct usb_device *list, struct arguments *arg)
+{
+   char path[PATH_MAX + 1], port[PATH_MAX + 1], buf[32];
+   char control[16], state[16], delay[16];
+   double wake;
+   int result, first = 0;
+
+   /* Every device is still handled, the first failure is returned */
+   while (list)
    {
-      err(EINVAL, "No such command, reverint to display device.");
-   }
+      result = usb_sysfs_path (list, path, sizeof (path));
+      if (result)
+      {
+         fprintf (stderr, "Failed locating device: %s\n", usb_strerror());
+         first = first ? first : result;
+         list = list->next;
+         continue;
+      }
 
-   usb_find_busses();
-   usb_find_devices();
+      if (arg->power && (result = usb_sysfs_write (path, "power/control", arg->power)))
+      {
+         fprintf (stderr, "Failed setting power policy: %s\n", usb_strerror());
+         first = first ? first : result;
+      }
 
-   //print_devices ();
-   //find_device (atoi(argv[1]), atoi(argv[2]), 0);
-   //list = find_devices (0xE6E6, 0x201, 0);
-   if (arg.path)
-   {
-      list = locate_device (arg.path);
+      if (arg->autosuspend >= 0)
+      {
+         snprintf (buf, sizeof (buf), "%d", arg->autosuspend);
+         if ((result = usb_sysfs_write (path, "power/autosuspend_delay_ms", buf)))
+         {
+            fprintf (stderr, "Failed setting autosuspend delay: %s\n", usb_strerror());
+            first = first ? first : result;
+         }
+      }
+
+      if (arg->lpm >= 0 && (result = power_set_lpm (list, path, arg->lpm)))
+      {
+         fprintf (stderr, "Failed setting LPM: %s\n", usb_strerror());
+         first = first ? first : result;
+      }
+
+      wake = arg->measure ? power_measure_wake (path) : -1;
+
+      if (usb_sysfs_read (path, "power/control", control, sizeof (control)))
+         strcpy (control, "?");
+      if (usb_sysfs_read (path, "power/runtime_status", state, sizeof (state)))
+         strcpy (state, "?");
+      if (usb_sysfs_read (path, "power/autosuspend_delay_ms", delay, sizeof (delay)))
+         strcpy (delay, "?");
+
+      printf ("%s/%s/%s control:%s status:%s autosuspend:%sms", PATH_USBFS,
+              list->bus->dirname, list->filename, control, state, delay);
+      if (!usb_sysfs_read (path, "power/usb2_hardware_lpm", buf, sizeof (buf)))
+         printf (" lpm:%s", buf);
+      if (!usb_sysfs_read (path, "power/usb3_hardware_lpm_u1", buf, sizeof (buf)))
+         printf (" u1:%s", buf);
+      if (!usb_sysfs_read (path, "power/usb3_hardware_lpm_u2", buf, sizeof (buf)))
+         printf (" u2:%s", buf);
+      if (!usb_sysfs_port (path, port, sizeof (port))
+          && !usb_sysfs_read (port, "power/usb3_lpm_permit", buf, sizeof (buf)))
+         printf (" permit:%s", buf);
+      if (wake >= 0)
+         printf (" wake:%.3f ms", wake);
+      else if (arg->measure)
+         printf (" wake:n/a");
+      printf ("\n");
+
+      list = list->next;
    }
-   else// if (arg.vid)
+
+   return first;
+}
+
+/* Display devices from a snapshot, filtered directly on the mapping */
+int display_snapshot (struct arguments *arg)
+{
+   struct usb_snap snap;
+   char path[PATH_MAX + 1];
+   const char *name;
+   int i;
+
+   if (usb_snap_open (arg->snapshot, &snap))
    {
-      list = find_devices (arg.vid, arg.pid, 0);
+      fprintf (stderr, "Failed reading snapshot: %s\n", usb_strerror());
+      return 1;
    }
-#if 0
-   else // (!arg.path && !arg.vid)
+
+   for (i = 0; i < snap.count; i++)
    {
-      errx(EINVAL, "You must specify a device path or VID[/PID] device match.");
+      if (!match_device (snap.vid[i], snap.pid[i], arg->vid, arg->pid))
+         continue;
+
+      snprintf (path, sizeof (path), "%s/%s/%s", PATH_USBFS,
+                usb_snap_str(&snap, busname, i), usb_snap_str(&snap, filename, i));
+      if (arg->path && strcmp (arg->path, path))
+         continue;
+
+      printf ("%s Dev:%d ", path, snap.devnum[i]);
+      if (snap.driver[i])
+         printf ("Driver:%s ", usb_snap_str(&snap, driver, i));
+      printf ("ID:%04X/%04X/%04X", snap.vid[i], snap.pid[i], snap.bcd[i]);
+      if (snap.manufacturer[i])
+         printf (" %s", usb_snap_str(&snap, manufacturer, i));
+      else if ((name = usb_ids_vendor (snap.vid[i])))
+         printf (" %s", name);
+      if (snap.product[i])
+         printf (" - %s", usb_snap_str(&snap, product, i));
+      else if ((name = usb_ids_product (snap.vid[i], snap.pid[i])))
+         printf (" - %s", name);
+      printf ("\n");
+
+      if (arg->verbose && snap.serial[i])
+         printf ("  Serial Number: %s\n", usb_snap_str(&snap, serial, i));
    }
-#endif
 
-   switch (cmd)
-   {
-      case STATUS:
-         status (list, arg.verbose);
-         break;
+   usb_snap_close (&snap);
 
-      case RESET:
-         reset (list, arg.verbose);
-         break;
+   return 0;
+}
 
-      case DISPLAY:
-      default:
-         /* Read usb_device_descriptor and print it out. */
-         display (list, arg.verbose);
-         break;
+/* The interface usb_claim_device() claims, in the setting selected on
+ * udev, or its default setting without a handle. */
+static struct usb_interface_descriptor *claimed_altsetting (struct usb_device *dev,
+                                                            struct usb_dev_handle *udev)
+{
+   struct usb_interface *intf;
+   int i, setting = 0;
+
+   if (!dev->config || !dev->config->interface)
+      return NULL;
+
+   intf = dev->config->interface;
+   if (udev && ((struct usb_dev_handle_ext *)udev)->altsetting > 0)
+      setting = ((struct usb_dev_handle_ext *)udev)->altsetting;
+   for (i = 0; i < intf->num_altsetting; i++)
+   {
+      if (intf->altsetting[i].bAlternateSetting == setting)
+         return &intf->altsetting[i];
    }
 
-   list_free (list);
+   return &intf->altsetting[0];
+}
 
-   return 0;
+/* usb_claim_device() and the alternate setting asked for, if any */
+static struct usb_dev_handle *claim (struct usb_device *dev, struct arguments *arg)
+{
+   struct usb_dev_handle *udev;
+   int result;
+
+   udev = usb_claim_device (dev);
+   if (!udev || arg->altsetting == ALTSETTING_DEFAULT)
+      return udev;
+
+   result = usb_select_altinterface (udev, arg->altsetting, arg->bandwidth);
+   if (result < 0)
+      fprintf (stderr, "Failed selecting alternate setting: %s\n", usb_strerror());
+   else if (arg->verbose)
+      fprintf (stderr, "Interface %d alternate setting %d\n", INTERFACE_NUMBER(dev), result);
+
+   return udev;
+}
+
+static int probe_int_one (struct usb_device *dev, struct arguments *arg)
+{
+   struct usb_interface_descriptor *alt;
+   struct usb_endpoint_descriptor *ep = NULL;
+   struct usb_dev_handle *udev;
+   struct usb_urb_ext *urb, *done;
+   struct timespec last, now;
+   struct usb_stat gap;
+   char path[PATH_MAX + 1];
+   char *buf;
+   double dev_sum = 0, us;
+   long interval, missed = 0, bytes = 0, slots;
+   int i, len, speed, count = 0, errors = 0, inflight = 0, timeout, result, fatal = 0;
+
+   /* The endpoints depend on the alternate setting claimed */
+   udev = claim (dev, arg);
+   if (!udev)
+   {
+      fprintf (stderr, "Failed claiming device: %s\n", usb_strerror());
+      return 1;
+   }
+
+   alt = claimed_altsetting (dev, udev);
+   for (i = 0; alt && i < alt->bNumEndpoints; i++)
+   {
+      struct usb_endpoint_descriptor *tmp = &alt->endpoint[i];
+
+      if (ENDPOINT_TYPE(tmp) != USB_ENDPOINT_TYPE_INTERRUPT || !ENDPOINT_IS_IN(tmp))
+         continue;
+      if (!arg->endpoint || tmp->bEndpointAddress == arg->endpoint)
+      {
+         ep = tmp;
+         break;
+      }
+   }
+   if (!ep)
+   {
+      fprintf (stderr, "No interrupt IN endpoint%s on interface %d\n",
+               arg->endpoint ? " with that address" : "", alt ? alt->bInterfaceNumber : 0);
+      usb_release_device (udev);
+      return 1;
+   }
+
+   speed = USB_SPEED_UNKNOWN;
+   if (!usb_sysfs_path (dev, path, sizeof (path)))
+      speed = usb_sysfs_speed (path);
+   interval = usb_endpoint_interval (ep, speed);
+
+   len = (ep->wMaxPacketSize & 0x7ff) * (1 + ((ep->wMaxPacketSize >> 11) & 3));
+   urb = calloc (arg->queue, sizeof (struct usb_urb_ext));
+   buf = calloc (arg->queue, len);
+   if (!urb || !buf)
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
+
+   for (i = 0; i < arg->queue; i++)
+   {
+      urb[i].type          = USB_URB_TYPE_INTERRUPT;
+      urb[i].endpoint      = ep->bEndpointAddress;
+      urb[i].buffer        = buf + i * len;
+      urb[i].buffer_length = len;
+      result = usb_submit_urb_np (udev, &urb[i]);
+      if (result)
+      {
+         fprintf (stderr, "Failed submitting transfer: %s\n", strerror (-result));
+         break;
+      }
+      inflight++;
+   }
+
+   /* Allow for a slow device, but not forever. */
+   timeout = interval / 1000 * 10;
+   if (timeout < 1000)
+      timeout = 1000;
+
+   usb_stat_init (&gap);
+   while (inflight && count < arg->count)
+   {
+      result = usb_reap_urb_np (udev, &done, timeout);
+      if (result)
+      {
+         fprintf (stderr, "Failed waiting %d ms for data: %s\n", timeout, strerror (-result));
+         break;
+      }
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      inflight--;
+
+      if (done->status)
+      {
+         errors++;
+
+         /* A halted or vanished endpoint never completes again */
+         if (done->status == -EPIPE || done->status == -ENODEV || done->status == -ESHUTDOWN
+             || errors >= arg->count)
+         {
+            fprintf (stderr, "Stopping after %d errors: %s\n", errors, strerror (-done->status));
+            fatal = 1;
+            break;
+         }
+      }
+      else
+      {
+         /* The first completion only starts the clock. */
+         if (count)
+         {
+            us = usb_diff_us (&last, &now);
+            usb_stat_add (&gap, us);
+            dev_sum += fabs (us - interval);
+            slots = interval ? (long)(us / interval + 0.5) : 1;
+            if (slots > 1)
+               missed += slots - 1;
+         }
+         last = now;
+         bytes += done->actual_length;
+         count++;
+      }
+
+      if (!usb_submit_urb_np (udev, done))
+         inflight++;
+   }
+
+   /* Cancel what is still queued before releasing the interface. */
+   for (i = 0; i < arg->queue; i++)
+      usb_discard_urb_np (udev, &urb[i]);
+   while (inflight-- > 0 && !usb_reap_urb_np (udev, &done, 1000))
+      ;
+
+   printf ("%s/%s/%s EP0x%02X Interrupt IN bInterval:%u expected:%ld us speed:%d Mbit/s\n",
+           PATH_USBFS, dev->bus->dirname, dev->filename, ep->bEndpointAddress,
+           ep->bInterval, interval, speed);
+   printf ("  transfers: %d  errors: %d  bytes: %ld  missed intervals: %ld\n",
+           count, errors, bytes, missed);
+   if (gap.num)
+   {
+      printf ("  interval: ");
+      usb_stat_print (stdout, &gap, "us");
+      printf ("\n  jitter: %.3f us mean deviation from bInterval, %.3f us stddev\n",
+              dev_sum / gap.num, usb_stat_stddev (&gap));
+      printf ("  histogram:\n");
+      usb_stat_histogram (stdout, &gap, "us");
+   }
+
+   usb_stat_free (&gap);
+   free (urb);
+   free (buf);
+   usb_release_device (udev);
+
+   return fatal;
+}
+
+/* Keep interrupt IN transfers queued and time their completions.  A
+ * device only completes a poll when it has data, so this measures the
+ * polling we get from a device that always has a report ready. */
+int probe_int (struct usb_device *list, struct arguments *arg)
+{
+   int result = 0;
+
+   while (list)
+   {
+      result |= probe_int_one (list, arg);
+      list = list->next;
+   }
+
+   return result;
+}
+
+struct bench_job
+{
+   struct usb_device **dev;
+   struct usb_stat *lat;
+   int *errors;
+   double *elapsed;
+   struct arguments *arg;
+};
+
+/* Keep --queue copies of the control request in flight on one device
+ * as usbfs URBs.  Latency runs from submit to reap, so it includes the
+ * time a request waits behind the ones queued before it. */
+static void bench_ctrl_queued (struct bench_job *job, int i, struct usb_dev_handle *udev)
+{
+   struct arguments *args = job->arg;
+   struct usb_urb_ext *urb, *done;
+   struct timespec *sent, now;
+   unsigned char *buf, *setup;
+   int n, len, inflight = 0, submitted = 0;
+
+   /* usbfs wants the setup packet in front of the data stage */
+   len  = 8 + args->length;
+   urb  = calloc (args->queue, sizeof (struct usb_urb_ext));
+   sent = calloc (args->queue, sizeof (struct timespec));
+   buf  = calloc (args->queue, len);
+   if (!urb || !sent || !buf)
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
+
+   for (n = 0; n < args->queue; n++)
+   {
+      setup = buf + n * len;
+      setup[0] = args->rtype;
+      setup[1] = args->request;
+      setup[2] = args->value & 0xff;
+      setup[3] = args->value >> 8;
+      setup[4] = args->index & 0xff;
+      setup[5] = args->index >> 8;
+      setup[6] = args->length & 0xff;
+      setup[7] = args->length >> 8;
+
+      urb[n].type          = USB_URB_TYPE_CONTROL;
+      urb[n].endpoint      = 0;
+      urb[n].buffer        = setup;
+      urb[n].buffer_length = len;
+   }
+
+   for (n = 0; n < args->queue && submitted < args->count; n++)
+   {
+      clock_gettime (CLOCK_MONOTONIC, &sent[n]);
+      if (usb_submit_urb_np (udev, &urb[n]))
+         break;
+      inflight++;
+      submitted++;
+   }
+
+   while (inflight)
+   {
+      if (usb_reap_urb_np (udev, &done, 1000))
+         break;
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      inflight--;
+
+      n = done - urb;
+      if (done->status)
+         job->errors[i]++;
+      else
+         usb_stat_add (&job->lat[i], usb_diff_us (&sent[n], &now));
+
+      if (submitted < args->count)
+      {
+         sent[n] = now;
+         if (!usb_submit_urb_np (udev, done))
+         {
+            inflight++;
+            submitted++;
+         }
+      }
+   }
+
+   /* Whatever timed out or never went out counts as failed */
+   job->errors[i] += args->count - submitted + inflight;
+   for (n = 0; inflight && n < args->queue; n++)
+      usb_discard_urb_np (udev, &urb[n]);
+   while (inflight-- > 0 && !usb_reap_urb_np (udev, &done, 1000))
+      ;
+
+   free (buf);
+   free (sent);
+   free (urb);
+}
+
+/* Issue the same control request back to back on one device, or with
+ * --queue kept in flight */
+static void bench_ctrl_one (int i, void *arg)
+{
+   struct bench_job *job = arg;
+   struct arguments *args = job->arg;
+   struct usb_dev_handle *udev;
+   struct timespec start, t0, t1;
+   char buf[4096];
+   int n;
+
+   udev = usb_open (job->dev[i]);
+   if (!udev)
+   {
+      job->errors[i] = args->count;
+      return;
+   }
+
+   memset (buf, 0, sizeof (buf));
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   if (args->queue > 1)
+      bench_ctrl_queued (job, i, udev);
+   for (n = 0; args->queue == 1 && n < args->count; n++)
+   {
+      clock_gettime (CLOCK_MONOTONIC, &t0);
+      if (usb_control_msg (udev, args->rtype, args->request, args->value, args->index,
+                           buf, args->length, 1000) < 0)
+      {
+         job->errors[i]++;
+         continue;
+      }
+      clock_gettime (CLOCK_MONOTONIC, &t1);
+      usb_stat_add (&job->lat[i], usb_diff_us (&t0, &t1));
+   }
+   job->elapsed[i] = usb_elapsed_ms (&start);
+
+   usb_close (udev);
+}
+
+/* Control request round-trip benchmark.  Requests to one device are
+ * synchronous unless --queue asks for more in flight, and up to --jobs
+ * devices are driven at the same time.  Fails if any request did. */
+int bench_ctrl (struct usb_device *list, struct arguments *arg)
+{
+   struct bench_job job;
+   struct usb_device *dev;
+   struct timespec start;
+   double wall;
+   long total = 0;
+   int i, num = 0, failed = 0;
+
+   for (dev = list; dev; dev = dev->next)
+      num++;
+   if (!num)
+      return 0;
+
+   job.dev     = calloc (num, sizeof (struct usb_device *));
+   job.lat     = calloc (num, sizeof (struct usb_stat));
+   job.errors  = calloc (num, sizeof (int));
+   job.elapsed = calloc (num, sizeof (double));
+   job.arg     = arg;
+   if (!job.dev || !job.lat || !job.errors || !job.elapsed)
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
+
+   for (i = 0, dev = list; dev; dev = dev->next, i++)
+   {
+      job.dev[i] = dev;
+      usb_stat_init (&job.lat[i]);
+   }
+
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   usb_pool_run (arg->jobs, num, bench_ctrl_one, &job);
+   wall = usb_elapsed_ms (&start);
+
+   for (i = 0; i < num; i++)
+   {
+      dev = job.dev[i];
+      printf ("%s/%s/%s requests:%d errors:%d rate:%.1f req/s\n", PATH_USBFS,
+              dev->bus->dirname, dev->filename, job.lat[i].num, job.errors[i],
+              job.elapsed[i] > 0 ? job.lat[i].num * 1000.0 / job.elapsed[i] : 0);
+      if (job.lat[i].num)
+      {
+         printf ("  latency: ");
+         usb_stat_print (stdout, &job.lat[i], "us");
+         printf ("\n");
+      }
+
+      total += job.lat[i].num;
+      failed += job.errors[i];
+      usb_stat_free (&job.lat[i]);
+   }
+
+   if (num > 1)
+      printf ("total: %ld requests in %.1f ms, %.1f req/s across %d devices\n",
+              total, wall, wall > 0 ? total * 1000.0 / wall : 0, num);
+
+   free (job.dev);
+   free (job.lat);
+   free (job.errors);
+   free (job.elapsed);
+
+   return failed ? 1 : 0;
+}
+
+struct ports_job
+{
+   struct usb_device **dev;
+   char **buf;
+   size_t *len;
+};
+
+/* Query every downstream port of one hub, empty ports included. */
+static void ports_one (int i, void *arg)
+{
+   struct ports_job *job = arg;
+   struct usb_device *dev = job->dev[i];
+   struct usb_dev_handle *udev;
+   struct usb_port_status st;
+   char hub[PATH_MAX + 1], child[PATH_MAX + 1], error[256];
+   int port, nports, ss, sysfs;
+   FILE *fp;
+
+   fp = job_output (&job->buf[i], &job->len[i]);
+
+   ss    = USB_IS_SS_HUB(dev);
+   sysfs = !usb_sysfs_path (dev, hub, sizeof (hub));
+   fprintf (fp, "%s/%s/%s Hub ID:%04X/%04X %s", PATH_USBFS, dev->bus->dirname,
+            dev->filename, dev->descriptor.idVendor, dev->descriptor.idProduct,
+            sysfs ? strrchr (hub, '/') + 1 : "");
+
+   udev = job_open (dev, error, sizeof (error));
+   if (!udev)
+   {
+      fprintf (fp, " could not open: %s\n", error);
+      job_output_done (fp);
+      return;
+   }
+
+   nports = usb_hub_nports (udev, ss);
+   if (nports < 0)
+   {
+      fprintf (fp, " no hub descriptor: %s\n", strerror (-nports));
+      goto done;
+   }
+   fprintf (fp, " ports:%d%s\n", nports, ss ? " super-speed" : "");
+
+   for (port = 1; port <= nports; port++)
+   {
+      int result = usb_hub_port_status (udev, port, &st);
+
+      fprintf (fp, "  port %2d: ", port);
+      if (result)
+      {
+         fprintf (fp, "no status: %s\n", strerror (-result));
+         continue;
+      }
+
+      usb_hub_port_print (fp, &st, ss);
+      if (sysfs && (st.status & USB_PORT_STAT_CONNECTION))
+      {
+         /* Connected but not enumerated is what a failed
+          * enumeration, or one still in progress, looks like. */
+         if (usb_sysfs_port_child (hub, port, child, sizeof (child)))
+            fprintf (fp, " not enumerated");
+         else
+            fprintf (fp, " %s", strrchr (child, '/') + 1);
+      }
+      fprintf (fp, "\n");
+   }
+
+done:
+   usb_close (udev);
+   job_output_done (fp);
+}
+
+/* Link state, speed and faults of every hub port in one sweep.  Hubs
+ * are queried in parallel, output is printed in list order. */
+int ports (struct usb_device *list, struct arguments *arg)
+{
+   struct ports_job job;
+   struct usb_device *dev;
+   int i, num = 0;
+
+   for (dev = list; dev; dev = dev->next)
+   {
+      if (USB_IS_HUB(dev))
+         num++;
+   }
+   if (!num)
+   {
+      fprintf (stderr, "No hubs found.\n");
+      return 1;
+   }
+
+   job.dev = calloc (num, sizeof (struct usb_device *));
+   job.buf = calloc (num, sizeof (char *));
+   job.len = calloc (num, sizeof (size_t));
+   if (!job.dev || !job.buf || !job.len)
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
+
+   for (i = 0, dev = list; dev; dev = dev->next)
+   {
+      if (USB_IS_HUB(dev))
+         job.dev[i++] = dev;
+   }
+
+   usb_pool_run (arg->jobs, num, ports_one, &job);
+
+   for (i = 0; i < num; i++)
+   {
+      if (job.buf[i])
+         fwrite (job.buf[i], 1, job.len[i], stdout);
+      free (job.buf[i]);
+   }
+
+   free (job.dev);
+   free (job.buf);
+   free (job.len);
+
+   return 0;
+}
+
+struct audit_job
+{
+   struct usb_device **dev;
+   char (*path)[PATH_MAX + 1];
+   unsigned char (*cid)[16];
+   int *speed, *cap, *has_cid;
+};
+
+static void audit_one (int i, void *arg)
+{
+   struct audit_job *job = arg;
+   struct usb_dev_handle *udev;
+
+   if (usb_sysfs_path (job->dev[i], job->path[i], sizeof (job->path[i])))
+      job->path[i][0] = 0;
+   else
+      job->speed[i] = usb_sysfs_speed (job->path[i]);
+
+   udev = usb_open (job->dev[i]);
+   if (udev)
+   {
+      job->cap[i] = usb_device_capability (udev, job->dev[i]);
+      if (USB_IS_HUB(job->dev[i]))
+         job->has_cid[i] = !usb_get_container_id (udev, job->cid[i]);
+      usb_close (udev);
+   }
+
+   /* Nothing better known, it runs at what it can. */
+   if (job->cap[i] < job->speed[i])
+      job->cap[i] = job->speed[i];
+}
+
+/* Find the hub nearest dev that runs slower than cap.  When no hub is
+ * slower the port, or cable, itself negotiated down. */
+static const char *audit_limit (const char *path, int cap, int *speed)
+{
+   static char hub[PATH_MAX + 1];
+   char tmp[PATH_MAX + 1];
+
+   strcpy (tmp, path);
+   while (!usb_sysfs_parent (tmp, hub, sizeof (hub), NULL))
+   {
+      *speed = usb_sysfs_speed (hub);
+      if (*speed && *speed < cap)
+         return strrchr (hub, '/') + 1;
+      strcpy (tmp, hub);
+   }
+
+   return NULL;
+}
+
+/* A USB 3 hub is two devices: a SuperSpeed hub and a USB 2.0 hub that
+ * runs at high speed by design, but whose BOS still claims SuperSpeed.
+ * The SuperSpeed half hangs off the peer of the USB 2.0 half's
+ * upstream port, and the halves share a Container ID. */
+static int audit_hub_twin (struct audit_job *job, int i, int num)
+{
+   char hub[PATH_MAX + 1], twin[PATH_MAX + 1];
+   int j, port;
+
+   if (!USB_IS_HUB(job->dev[i]) || job->speed[i] >= USB_SPEED_SUPER
+       || job->cap[i] < USB_SPEED_SUPER)
+      return 0;
+
+   if (!usb_sysfs_port_peer (job->path[i], hub, sizeof (hub), &port)
+       && !usb_sysfs_port_child (hub, port, twin, sizeof (twin))
+       && usb_sysfs_speed (twin) >= USB_SPEED_SUPER)
+      return 1;
+
+   for (j = 0; job->has_cid[i] && j < num; j++)
+   {
+      if (j == i || !USB_IS_HUB(job->dev[j]) || job->speed[j] < USB_SPEED_SUPER)
+         continue;
+
+      if (job->has_cid[j] && !memcmp (job->cid[i], job->cid[j], 16))
+         return 1;
+   }
+
+   return 0;
+}
+
+/* List every device running below the speed its descriptors claim,
+ * with the upstream hub that limits it. */
+int audit (struct usb_device *list, struct arguments *arg)
+{
+   struct audit_job job;
+   struct usb_device *dev;
+   const char *hub;
+   int i, speed, num = 0, slow = 0;
+
+   for (dev = list; dev; dev = dev->next)
+      num++;
+   if (!num)
+      return 0;
+
+   job.dev   = calloc (num, sizeof (struct usb_device *));
+   job.path  = calloc (num, sizeof (*job.path));
+   job.speed = calloc (num, sizeof (int));
+   job.cap   = calloc (num, sizeof (int));
+   job.cid   = calloc (num, sizeof (*job.cid));
+   job.has_cid = calloc (num, sizeof (int));
+   if (!job.dev || !job.path || !job.speed || !job.cap || !job.cid || !job.has_cid)
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
+
+   for (i = 0, dev = list; dev; dev = dev->next)
+      job.dev[i++] = dev;
+
+   usb_pool_run (arg->jobs, num, audit_one, &job);
+
+   for (i = 0; i < num; i++)
+   {
+      dev = job.dev[i];
+      if (!job.path[i][0])
+         continue;
+      if (job.speed[i] >= job.cap[i] || audit_hub_twin (&job, i, num))
+      {
+         if (arg->verbose)
+            printf ("%s/%s/%s ID:%04X/%04X %s: %d Mbit/s OK\n", PATH_USBFS,
+                    dev->bus->dirname, dev->filename, dev->descriptor.idVendor,
+                    dev->descriptor.idProduct, strrchr (job.path[i], '/') + 1,
+                    job.speed[i]);
+         continue;
+      }
+
+      slow++;
+      printf ("%s/%s/%s ID:%04X/%04X %s: %d Mbit/s, capable of %d Mbit/s",
+              PATH_USBFS, dev->bus->dirname, dev->filename, dev->descriptor.idVendor,
+              dev->descriptor.idProduct, strrchr (job.path[i], '/') + 1,
+              job.speed[i], job.cap[i]);
+
+      hub = audit_limit (job.path[i], job.cap[i], &speed);
+      if (hub)
+         printf (", limited by hub %s at %d Mbit/s\n", hub, speed);
+      else
+         printf (", limited by its port or cable\n");
+   }
+
+   if (!arg->silent)
+      printf ("%d of %d devices below capability\n", slow, num);
+
+   free (job.dev);
+   free (job.path);
+   free (job.speed);
+   free (job.cap);
+   free (job.cid);
+   free (job.has_cid);
+
+   return slow ? 1 : 0;
+}
+
+static volatile sig_atomic_t running = 1;
+
+static void stop (int signo)
+{
+   running = 0;
+}
+
+/* Record hotplug events until interrupted, then report how long each
+ * VID/PID took from add to bind and to ready, over the whole journal. */
+int monitor (struct arguments *arg)
+{
+   struct usb_journal journal;
+   struct usb_event ev;
+   struct sigaction sa;
+   int sd, result;
+
+   /* An empty file name keeps the journal in memory only. */
+   if (usb_journal_open (arg->journal[0] ? arg->journal : NULL, 0, &journal))
+   {
+      fprintf (stderr, "Failed opening journal: %s\n", usb_strerror());
+      return 1;
+   }
+
+   sd = usb_event_open ();
+   if (sd < 0)
+   {
+      fprintf (stderr, "Failed listening for events: %s\n", usb_strerror());
+      usb_journal_close (&journal);
+      return 1;
+   }
+
+   /* No SA_RESTART, a signal must break out of recv(). */
+   memset (&sa, 0, sizeof (sa));
+   sa.sa_handler = stop;
+   sigaction (SIGINT, &sa, NULL);
+   sigaction (SIGTERM, &sa, NULL);
+
+   while (running)
+   {
+      result = usb_event_read (sd, &ev);
+      if (result < 0)
+      {
+         if (result == -EINTR)
+            continue;
+         if (result == -ENOBUFS)
+         {
+            fprintf (stderr, "Events lost, receive buffer overrun\n");
+            continue;
+         }
+         fprintf (stderr, "Failed reading event: %s\n", strerror (-result));
+         break;
+      }
+      if (result)
+         continue;
+
+      usb_journal_append (&journal, &ev);
+      if (!arg->silent)
+      {
+         usb_event_print (stdout, &ev);
+         fflush (stdout);
+      }
+   }
+   close (sd);
+
+   usb_journal_report (stdout, &journal);
+   usb_journal_close (&journal);
+
+   return 0;
+}
+
+/* Dump a journal and its latency report */
+int journal (struct arguments *arg)
+{
+   struct usb_journal journal;
+   uint64_t i, first, head;
+
+   if (!arg->journal || usb_journal_open (arg->journal, 1, &journal))
+   {
+      fprintf (stderr, "Failed opening journal: %s\n", usb_strerror());
+      return 1;
+   }
+
+   head  = journal.hdr->head;
+   first = head > journal.hdr->capacity ? head - journal.hdr->capacity : 0;
+   for (i = first; arg->verbose && i < head; i++)
+      usb_event_print (stdout, &journal.rec[i % journal.hdr->capacity]);
+
+   usb_journal_report (stdout, &journal);
+   usb_journal_close (&journal);
+
+   return 0;
+}
+
+static int pipe_endpoint_ok (struct usb_interface_descriptor *alt, int address, int in)
+{
+   struct usb_endpoint_descriptor *ep;
+
+   ep = alt ? usb_find_endpoint (alt, address) : NULL;
+
+   return ep && ENDPOINT_TYPE(ep) == USB_ENDPOINT_TYPE_BULK && !ENDPOINT_IS_IN(ep) == !in;
+}
+
+static void pipe_init_urbs (struct usb_urb_ext *urb, char *buf, int num, int ep, int size)
+{
+   int i;
+
+   for (i = 0; i < num; i++)
+   {
+      urb[i].type          = USB_URB_TYPE_BULK;
+      urb[i].endpoint      = ep;
+      urb[i].buffer        = buf + i * size;
+      urb[i].buffer_length = size;
+   }
+}
+
+/* Stream stdin to a bulk OUT endpoint and a bulk IN endpoint to stdout.
+ * A fixed set of page aligned buffers is reused, queue deep in each
+ * direction, so the bus always has work queued and memory stays flat. */
+int bulk_pipe (struct usb_device *list, struct arguments *arg)
+{
+   struct usb_interface_descriptor *alt;
+   struct usb_dev_handle *udev;
+   struct usb_urb_ext *urb, *out, *in, *done, *fill = NULL, **idle;
+   struct timespec start, last;
+   struct pollfd pfd[2];
+   struct sigaction sa;
+   char *buf;
+   long long bytes_out = 0, bytes_in = 0;
+   int i, num, len, result = 0, eof, nidle = 0, inflight = 0, outflight = 0, filled = 0;
+
+   if (!list || list->next)
+   {
+      fprintf (stderr, "PIPE needs exactly one device, use -D or a unique VID/PID\n");
+      return 1;
+   }
+
+   udev = claim (list, arg);
+   if (!udev)
+   {
+      fprintf (stderr, "Failed claiming device: %s\n", usb_strerror());
+      return 1;
+   }
+
+   alt = claimed_altsetting (list, udev);
+   if ((!arg->out && !arg->in)
+       || (arg->out && !pipe_endpoint_ok (alt, arg->out, 0))
+       || (arg->in && !pipe_endpoint_ok (alt, arg->in, 1)))
+   {
+      fprintf (stderr, "PIPE needs bulk endpoints on interface %d, see --out and --in\n",
+               alt ? alt->bInterfaceNumber : 0);
+      usb_release_device (udev);
+      return 1;
+   }
+
+   urb  = calloc (2 * arg->queue, sizeof (struct usb_urb_ext));
+   idle = calloc (arg->queue, sizeof (struct usb_urb_ext *));
+   if (!urb || !idle || posix_memalign ((void **)&buf, getpagesize (), 2 * arg->queue * arg->size))
+   {
+      errx (ENOMEM, "Yikes! No memory ... bailing out.");
+   }
+   out = urb;
+   in  = urb + arg->queue;
+   pipe_init_urbs (out, buf, arg->queue, arg->out, arg->size);
+   pipe_init_urbs (in, buf + arg->queue * arg->size, arg->queue, arg->in, arg->size);
+
+   memset (&sa, 0, sizeof (sa));
+   sa.sa_handler = stop;
+   sigaction (SIGINT, &sa, NULL);
+   sigaction (SIGTERM, &sa, NULL);
+   signal (SIGPIPE, SIG_IGN);
+
+   eof = !arg->out;
+   for (i = 0; arg->out && i < arg->queue; i++)
+      idle[nidle++] = &out[i];
+   for (i = 0; arg->in && i < arg->queue; i++)
+   {
+      if (usb_submit_urb_np (udev, &in[i]))
+         break;
+      inflight++;
+   }
+
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   last = start;
+   while (running)
+   {
+      if (eof && !outflight)
+      {
+         if (!inflight)
+            break;
+         /* Nothing more to send, drain IN until it goes quiet. */
+         if (arg->out && usb_elapsed_ms (&last) > (arg->timeout ? arg->timeout : 1000))
+            break;
+      }
+      if (arg->timeout && !arg->out && usb_elapsed_ms (&last) > arg->timeout)
+         break;
+
+      num = 0;
+      if (!eof && (fill || nidle))
+      {
+         pfd[num].fd = STDIN_FILENO;
+         pfd[num++].events = POLLIN;
+      }
+      if (inflight + outflight)
+      {
+         pfd[num].fd = usb_get_fd_np (udev);
+         pfd[num++].events = POLLOUT;
+      }
+      if (poll (pfd, num, 100) < 0 && errno != EINTR)
+         break;
+
+      /* Pipes hand out whatever the writer wrote, so reads are
+       * gathered into one buffer until it holds --size bytes.  Only
+       * the last transfer before EOF may be short. */
+      if (!eof && (fill || nidle) && pfd[0].revents)
+      {
+         if (!fill)
+         {
+            fill = idle[--nidle];
+            filled = 0;
+         }
+         len = read (STDIN_FILENO, (char *)fill->buffer + filled, arg->size - filled);
+         if (len < 0 && errno == EINTR)
+            continue;
+         if (len <= 0)
+         {
+            eof = 1;
+            clock_gettime (CLOCK_MONOTONIC, &last);
+         }
+         else
+            filled += len;
+
+         if (filled == arg->size || (eof && filled))
+         {
+            fill->buffer_length = filled;
+            result = usb_submit_urb_np (udev, fill);
+            if (result)
+            {
+               fprintf (stderr, "Failed sending: %s\n", strerror (-result));
+               break;
+            }
+            outflight++;
+            fill = NULL;
+         }
+         else if (eof)
+         {
+            idle[nidle++] = fill;
+            fill = NULL;
+         }
+      }
+
+      while (!usb_reap_urb_np (udev, &done, 0))
+      {
+         if (done < in)
+         {
+            outflight--;
+            idle[nidle++] = done;
+            bytes_out += done->actual_length;
+            if (done->status)
+            {
+               result = done->status;
+               fprintf (stderr, "Failed sending: %s\n", strerror (-result));
+               running = 0;
+            }
+            continue;
+         }
+
+         inflight--;
+         if (done->status)
+         {
+            result = done->status;
+            fprintf (stderr, "Failed receiving: %s\n", strerror (-result));
+            running = 0;
+            continue;
+         }
+
+         for (len = 0; len < done->actual_length; len += i)
+         {
+            i = write (STDOUT_FILENO, (char *)done->buffer + len, done->actual_length - len);
+            if (i <= 0)
+               break;
+         }
+         if (len < done->actual_length)
+         {
+            running = 0;
+            continue;
+         }
+         bytes_in += len;
+         if (len)
+            clock_gettime (CLOCK_MONOTONIC, &last);
+
+         if (running && !usb_submit_urb_np (udev, done))
+            inflight++;
+      }
+   }
+
+   /* Cancel everything still queued before releasing the interface. */
+   for (i = 0; i < 2 * arg->queue; i++)
+      usb_discard_urb_np (udev, &urb[i]);
+   while (inflight + outflight > 0 && !usb_reap_urb_np (udev, &done, 1000))
+   {
+      if (done >= in)
+         inflight--;
+      else
+         outflight--;
+   }
+
+   if (arg->verbose)
+   {
+      double ms = usb_elapsed_ms (&start);
+
+      fprintf (stderr, "Sent %lld bytes, received %lld bytes in %.1f ms, %.2f MB/s\n",
+               bytes_out, bytes_in, ms,
+               ms > 0 ? (bytes_out + bytes_in) / ms / 1000.0 : 0);
+   }
+
+   free (buf);
+   free (idle);
+   free (urb);
+   usb_release_device (udev);
+
+   return result ? 1 : 0;
+}
+
+#define RECOVER_SETTLE    5000  /* ms to wait for a device to come back */
+#define RECOVER_POWER_OFF  500  /* ms a port is left unpowered */
+
+static const char *recover_level[] =
+{
+   "nothing", "clear-halt", "set-configuration", "reset", "port power-cycle"
+};
+
+/* The device's current entry in libusb's bus list, looked up through
+ * its sysfs node since re-enumeration gives it a new address. */
+static struct usb_device *recover_find (const char *path)
+{
+   struct usb_bus *bus;
+   struct usb_device *dev;
+   char buf[16];
+   int busnum, devnum;
+
+   if (usb_sysfs_read (path, "busnum", buf, sizeof (buf)))
+      return NULL;
+   busnum = atoi (buf);
+   if (usb_sysfs_read (path, "devnum", buf, sizeof (buf)))
+      return NULL;
+   devnum = atoi (buf);
+
+   usb_find_busses ();
+   usb_find_devices ();
+   for (bus = usb_busses; bus; bus = bus->next)
+   {
+      if (atoi (bus->dirname) != busnum)
+         continue;
+
+      for (dev = bus->devices; dev; dev = dev->next)
+      {
+         if (dev->devnum == devnum)
+            return dev;
+      }
+   }
+
+   return NULL;
+}
+
+/* Wait for a re-enumerated device to answer again. */
+static struct usb_dev_handle *recover_reopen (const char *path)
+{
+   struct usb_dev_handle *udev;
+   struct usb_device *dev;
+   struct timespec start;
+
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   do
+   {
+      usleep (50000);
+      dev = recover_find (path);
+      if (!dev)
+         continue;
+
+      udev = usb_claim_device (dev);
+      if (!udev)
+         continue;
+      if (status_alive (udev))
+         return udev;
+      usb_release_device (udev);
+   }
+   while (usb_elapsed_ms (&start) < RECOVER_SETTLE);
+
+   return NULL;
+}
+
+/* Endpoints of the claimed interface that report a halt, cleared
+ * with CLEAR_FEATURE(ENDPOINT_HALT) when clear is set. */
+static int recover_halted (struct usb_dev_handle *udev, struct usb_device *dev, int clear)
+{
+   struct usb_interface_descriptor *alt;
+   char st[2];
+   int i, ep, num = 0;
+
+   alt = claimed_altsetting (dev, udev);
+   for (i = 0; alt && i < alt->bNumEndpoints; i++)
+   {
+      ep = alt->endpoint[i].bEndpointAddress;
+      if (usb_control_msg (udev, USB_ENDPOINT_IN | USB_RECIP_ENDPOINT, USB_REQ_GET_STATUS,
+                           0, ep, st, 2, 1000) == 2 && (st[0] & 1))
+      {
+         if (!clear || usb_clear_halt (udev, ep))
+            num++;
+      }
+   }
+
+   return num;
+}
+
+/* Healthy is ep0 answering and no halted endpoints.  A halt does not
+ * show on ep0, so both are checked. */
+static int recover_healthy (struct usb_dev_handle *udev, struct usb_device *dev)
+{
+   return status_alive (udev) && !recover_halted (udev, dev, 0);
+}
+
+/* Re-select the active configuration.  The kernel refuses while any
+ * interface is claimed, by a driver or by us, so all are let go first.
+ * The kernel binds drivers to the new interfaces itself. */
+static int recover_set_config (struct usb_dev_handle *udev, struct usb_device *dev)
+{
+   int i, result;
+
+   if (!dev->config)
+      return -ENODEV;
+
+   usb_release_interface (udev, INTERFACE_NUMBER(dev));
+   for (i = 0; i < dev->config->bNumInterfaces; i++)
+   {
+      if (!dev->config->interface[i].num_altsetting)
+         continue;
+#ifdef LIBUSB_HAS_GET_DRIVER_NP
+      usb_detach_kernel_driver_np (udev, dev->config->interface[i].altsetting[0].bInterfaceNumber);
+#endif
+   }
+
+   result = usb_set_configuration (udev, dev->config->bConfigurationValue);
+
+#ifdef LIBUSB_HAS_GET_DRIVER_NP
+   usb_detach_kernel_driver_np (udev, INTERFACE_NUMBER(dev));
+#endif
+   usb_claim_interface (udev, INTERFACE_NUMBER(dev));
+
+   return result;
+}
+
+static int recover_port_power (const char *hub, int port, int on)
+{
+   struct usb_dev_handle *udev;
+   struct usb_device *dev;
+   int result;
+
+   dev = recover_find (hub);
+   if (!dev)
+      return -ENODEV;
+   udev = usb_open (dev);
+   if (!udev)
+      return -EIO;
+
+   result = usb_hub_port_feature (udev, port, USB_PORT_FEAT_POWER, on);
+   usb_close (udev);
+
+   return result;
+}
+
+/* Switch the upstream hub port off and on again.  A USB 3 port is two
+ * ports, the device would just re-enumerate on the other half, so its
+ * USB 2.0 or SuperSpeed peer is switched along with it. */
+static int recover_power_cycle (const char *path)
+{
+   char parent[PATH_MAX + 1], peer[PATH_MAX + 1];
+   int port, peer_port, result, twin;
+
+   if (usb_sysfs_parent (path, parent, sizeof (parent), &port))
+      return -ENOENT;
+   twin = !usb_sysfs_port_peer (path, peer, sizeof (peer), &peer_port);
+
+   result = recover_port_power (parent, port, 0);
+   if (result)
+      return result;
+   if (twin)
+      recover_port_power (peer, peer_port, 0);
+
+   usleep (RECOVER_POWER_OFF * 1000);
+
+   if (twin)
+      recover_port_power (peer, peer_port, 1);
+
+   return recover_port_power (parent, port, 1);
+}
+
+static int recover_one (struct usb_device *dev, struct arguments *arg)
+{
+   struct usb_dev_handle *udev;
+   struct timespec start, t0;
+   char path[PATH_MAX + 1];
+   int level, result;
+
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   if (usb_sysfs_path (dev, path, sizeof (path)))
+      path[0] = 0;
+
+   printf ("%s/%s/%s ID:%04X/%04X %s: ", PATH_USBFS, dev->bus->dirname, dev->filename,
+           dev->descriptor.idVendor, dev->descriptor.idProduct,
+           path[0] ? strrchr (path, '/') + 1 : "");
+
+   /* Someone else has it, or the queue timed out.  Never pull the
+    * power on a device we could not claim. */
+   udev = usb_claim_device (dev);
+   if (!udev)
+   {
+      printf ("not claimed, leaving it alone: %s\n", usb_strerror());
+      return 1;
+   }
+   if (recover_healthy (udev, dev))
+   {
+      printf ("healthy\n");
+      usb_release_device (udev);
+      return 0;
+   }
+   if (arg->verbose)
+      printf ("\n");
+
+   for (level = 1; level < sizeof (recover_level) / sizeof (recover_level[0]); level++)
+   {
+      clock_gettime (CLOCK_MONOTONIC, &t0);
+      switch (level)
+      {
+         case 1:
+            /* GET_STATUS and CLEAR_FEATURE go over ep0 too */
+            if (!udev || !status_alive (udev))
+               result = -ENODEV;
+            else
+               result = recover_halted (udev, dev, 1) ? -EPIPE : 0;
+            break;
+
+         case 2:
+            result = udev ? recover_set_config (udev, dev) : -ENODEV;
+            break;
+
+         case 3:
+            /* The old handle is useless after re-enumeration */
+            if (!udev || !path[0])
+            {
+               result = -ENODEV;
+               break;
+            }
+            result = usb_reset (udev);
+            usb_release_device (udev);
+            udev = recover_reopen (path);
+            break;
+
+         default:
+            if (!path[0])
+            {
+               result = -ENODEV;
+               break;
+            }
+            if (udev)
+               usb_release_device (udev);
+            result = recover_power_cycle (path);
+            udev = result ? NULL : recover_reopen (path);
+            break;
+      }
+
+      if (arg->verbose)
+         printf ("  %-18s %s, %.1f ms\n", recover_level[level],
+                 result < 0 ? strerror (-result) : "done", usb_elapsed_ms (&t0));
+
+      if (udev && recover_healthy (udev, dev))
+      {
+         printf ("recovered by %s in %.1f ms\n", recover_level[level],
+                 usb_elapsed_ms (&start));
+         usb_release_device (udev);
+         return 0;
+      }
+   }
+
+   printf ("not recovered after %.1f ms\n", usb_elapsed_ms (&start));
+   if (udev)
+      usb_release_device (udev);
+
+   return 1;
+}
+
+/* Try the cheapest fix first and escalate until the device answers
+ * the STATUS control request again, with no halted endpoints. */
+int recover (struct usb_device *list, struct arguments *arg)
+{
+   int result = 0;
+
+   while (list)
+   {
+      result |= recover_one (list, arg);
+      list = list->next;
+   }
+
+   return result;
+}
+
+int list_free (struct usb_device *list)
+{
+   struct usb_device *dev;
+
+   while (list)
+   {
+      dev = list;
+      list = dev->next;
+
+      free (dev);
+   }
+
+   return 0;
+}
+
+typedef enum {DISPLAY = 0, STATUS, RESET, POWER, SAVE, IDS, PROBE_INT, BENCH_CTRL, MONITOR, JOURNAL, PIPE, PORTS, AUDIT, RECOVER} op_t;
+
+typedef struct {
+  char *command;
+  op_t  cmd;
+} cmd_t;
+
+cmd_t command_map[] = {
+   {"DISPLAY", DISPLAY},
+   {"SHOW", DISPLAY},
+   {"STATUS", STATUS},
+   {"RESET", RESET},
+   {"POWER", POWER},
+   {"PM", POWER},
+   {"SAVE", SAVE},
+   {"IDS", IDS},
+   {"PROBE-INT", PROBE_INT},
+   {"BENCH-CTRL", BENCH_CTRL},
+   {"MONITOR", MONITOR},
+   {"JOURNAL", JOURNAL},
+   {"PIPE", PIPE},
+   {"PORTS", PORTS},
+   {"AUDIT", AUDIT},
+   {"RECOVER", RECOVER},
+};
+
+#define ARRAY_SIZE(a) sizeof((a)) / sizeof((a)[0])
+
+int map_command_to_cmd (char *command)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(command_map); i++)
+    {
+      if (!strcasecmp (command_map[i].command, command))
+        return command_map[i].cmd;
+    }
+
+  return -1;
+}
+
+
+
+int main (int argc, char **argv)
+{
+   int cmd, direct = 0, result;
+   struct usb_device *list;
+   struct arguments arg;
+   struct stat st;
+   /* Our argp parser. */
+   static struct argp argp = { options, parse_opt, args_doc, doc };
+
+   /* Default values. */
+   arg.silent  = 0;
+   arg.verbose = 0;
+   arg.parsable = 0;
+   arg.jobs    = 8;
+   arg.vid     = 0;
+   arg.pid     = 0;
+   arg.path    = getenv ("DEVICE");
+   arg.snapshot = NULL;
+   arg.ids     = USB_IDS_INDEX;
+   arg.usbids  = USB_IDS_SOURCE;
+   arg.journal = USB_JOURNAL_FILE;
+   arg.power   = NULL;
+   arg.autosuspend = -1;
+   arg.lpm     = -1;
+   arg.measure = 0;
+   arg.endpoint = 0;
+   arg.count   = 1000;
+   arg.queue   = 0;
+   arg.out     = 0;
+   arg.in      = 0;
+   arg.size    = 16384;
+   arg.timeout = 0;
+   arg.altsetting = ALTSETTING_DEFAULT;
+   arg.bandwidth = 0;
+   arg.rtype   = USB_ENDPOINT_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE;
+   arg.request = USB_REQ_GET_STATUS;
+   arg.value   = 0;
+   arg.index   = 0;
+   arg.length  = 2;
+   arg.cmd[0]  = "DISPLAY";
+
+   /* Parse our arguments; every option seen by `parse_opt' will
+      be reflected in `arguments'. */
+   argp_parse (&argp, argc, argv, 0, 0, &arg);
+
+   usb_init();
+
+   cmd = map_command_to_cmd (arg.cmd[0]);
+   if (cmd < 0)
+   {
+      err(EINVAL, "No such command, reverint to display device.");
+   }
+   if (!arg.queue)
+      arg.queue = cmd == BENCH_CTRL ? 1 : 4;
+   if (arg.snapshot && cmd != DISPLAY && cmd != SAVE)
+   {
+      errx(EINVAL, "--snapshot only works with SHOW and SAVE.");
+   }
+
+   if (cmd == IDS)
+   {
+      int num = usb_ids_compile (arg.usbids, arg.ids);
+
+      if (num < 0)
+         errx(1, "Failed compiling name index: %s", usb_strerror());
+      printf ("Compiled %d names from %s into %s\n", num, arg.usbids, arg.ids);
+
+      return 0;
+   }
+
+   /* Hotplug events need no bus scan at all. */
+   if (cmd == MONITOR)
+   {
+      return monitor (&arg);
+   }
+   if (cmd == JOURNAL)
+   {
+      return journal (&arg);
+   }
+
+   /* Without an index devices are shown with their own strings only. */
+   usb_ids_open (arg.ids);
+
+   /* A snapshot replaces bus enumeration altogether. */
+   if (arg.snapshot && cmd == DISPLAY)
+   {
+      return display_snapshot (&arg);
+   }
+   if (cmd == SAVE && !arg.snapshot)
+   {
+      errx(EINVAL, "SAVE needs a snapshot file, see --snapshot.");
+   }
+
+   //print_devices ();
+   //find_device (atoi(argv[1]), atoi(argv[2]), 0);
+   //list = find_devices (0xE6E6, 0x201, 0);
+   if (arg.path)
+   {
+      /* Read only this device's descriptors, the cost of a udev
+       * event must not grow with the number of attached devices. */
+      list = get_usb_device_direct (arg.path);
+      direct = list != NULL;
+      /* A sysfs directory is where the device lives, no need to
+       * search for it again later. */
+      if (direct && !stat (arg.path, &st) && S_ISDIR(st.st_mode))
+         usb_sysfs_remember (list, arg.path);
+      if (!list)
+      {
+         usb_find_busses();
+         usb_find_devices();
+         list = locate_device (arg.path);
+      }
+   }
+   else// if (arg.vid)
+   {
+      list = find_devices (arg.vid, arg.pid, 0);
+   }
+#if 0
+   else // (!arg.path && !arg.vid)
+   {
+      errx(EINVAL, "You must specify a device path or VID[/PID] device match.");
+   }
+#endif
+
+   switch (cmd)
+   {
+      case STATUS:
+         result = status (list, arg.verbose);
+         break;
+
+      case RESET:
+         result = reset (list, arg.verbose);
+         break;
+
+      case POWER:
+         result = power (list, &arg);
+         break;
+
+      case PROBE_INT:
+         result = probe_int (list, &arg);
+         break;
+
+      case BENCH_CTRL:
+         result = bench_ctrl (list, &arg);
+         break;
+
+      case PIPE:
+         result = bulk_pipe (list, &arg);
+         break;
+
+      case PORTS:
+         result = ports (list, &arg);
+         break;
+
+      case AUDIT:
+         result = audit (list, &arg);
+         break;
+
+      case RECOVER:
+         result = recover (list, &arg);
+         break;
+
+      case SAVE:
+         result = usb_snap_write (arg.snapshot, list, arg.jobs);
+         if (result)
+            fprintf (stderr, "Failed saving snapshot: %s\n", usb_strerror());
+         break;
+
+      case DISPLAY:
+      default:
+         /* Read usb_device_descriptor and print it out. */
+         result = display (list, arg.verbose, arg.parsable, arg.jobs);
+         break;
+   }
+
+   /* Stdout may be a PIPE data stream */
+   if (arg.verbose)
+      usb_lock_report (stderr);
+
+   if (direct)
+      free_usb_device (list);
+   else
+      list_free (list);
+
+   /* Let scripts tell a failed or failing check from success */
+   return result ? 1 : 0;
 }
 
 
@@ -0,0 +1,350 @@
+/* usbdesc.c  --  Descriptor decoding helpers.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "usbdesc.h"
+#include "usbsysfs.h"
+
+struct usb_endpoint_descriptor *usb_find_endpoint (struct usb_interface_descriptor *alt, int address)
+{
+   int i;
+
+   for (i = 0; i < alt->bNumEndpoints; i++)
+   {
+      if (alt->endpoint[i].bEndpointAddress == address)
+         return &alt->endpoint[i];
+   }
+
+   return NULL;
+}
+
+/* Service interval of a periodic endpoint in microseconds at the given
+ * speed, or 0 for bulk and control endpoints.  Full and low speed
+ * interrupt endpoints give bInterval in frames, everything else is
+ * 2^(bInterval-1) frames or microframes.  Unknown speed is treated as
+ * full speed. */
+long usb_endpoint_interval (struct usb_endpoint_descriptor *ep, int speed)
+{
+   int type = ENDPOINT_TYPE(ep);
+   int exp = ep->bInterval;
+
+   if (type != USB_ENDPOINT_TYPE_INTERRUPT && type != USB_ENDPOINT_TYPE_ISOCHRONOUS)
+      return 0;
+
+   if (speed <= USB_SPEED_FULL)
+   {
+      if (type == USB_ENDPOINT_TYPE_INTERRUPT)
+         return (exp ? exp : 1) * 1000L;
+
+      return (1L << ((exp < 1 ? 1 : exp > 16 ? 16 : exp) - 1)) * 1000L;
+   }
+
+   return (1L << ((exp < 1 ? 1 : exp > 16 ? 16 : exp) - 1)) * 125L;
+}
+
+/* Find the SuperSpeed companion among the descriptors libusb left in
+ * the endpoint's extra buffer.  Returns 1 if there is one. */
+int usb_endpoint_companion (struct usb_endpoint_descriptor *ep, struct usb_ss_companion *comp)
+{
+   unsigned char *buf = ep->extra;
+   int pos = 0;
+
+   memset (comp, 0, sizeof (*comp));
+   while (buf && pos + 2 <= ep->extralen && buf[pos] >= 2)
+   {
+      if (buf[pos + 1] == USB_DT_SS_ENDPOINT_COMP && buf[pos] >= 6)
+      {
+         comp->present           = 1;
+         comp->bMaxBurst         = buf[pos + 2];
+         comp->bmAttributes      = buf[pos + 3];
+         comp->wBytesPerInterval = buf[pos + 4] | (buf[pos + 5] << 8);
+      }
+      else if (buf[pos + 1] == USB_DT_SSP_ISOC_ENDPOINT_COMP && buf[pos] >= 8)
+      {
+         comp->dwBytesPerInterval = buf[pos + 4] | (buf[pos + 5] << 8)
+            | (buf[pos + 6] << 16) | ((uint32_t)buf[pos + 7] << 24);
+      }
+      pos += buf[pos];
+   }
+
+   return comp->present;
+}
+
+/* Payload bytes per second the link can carry for one bulk endpoint
+ * with nothing else on the bus: 19 64-byte transactions per full speed
+ * frame, 13 512-byte transactions per high speed microframe, and for
+ * SuperSpeed the line rate after encoding less the per-packet header,
+ * CRC and framing and the ACK wait that ends every burst. */
+#define SS_PACKET_OVERHEAD 28
+
+/* Link round trip, in seconds, between the end of a burst and the
+ * ACK that lets the next one start */
+#define SS_TURNAROUND 1e-6
+
+static double bulk_throughput (int maxp, int burst, int speed)
+{
+   double line;
+
+   /* Same as usb_endpoint_interval(), no speed means full speed */
+   if (speed == USB_SPEED_UNKNOWN)
+      speed = USB_SPEED_FULL;
+
+   if (speed <= USB_SPEED_LOW)
+      return 0;
+   if (speed <= USB_SPEED_FULL)
+      return 19.0 * maxp * 1000;
+   if (speed <= USB_SPEED_HIGH)
+      return 13.0 * maxp * 8000;
+
+   if (speed <= USB_SPEED_SUPER)
+      line = speed * 1e6 / 10;                 /* 8b/10b */
+   else
+      line = speed * 1e6 / 8 * 128 / 132;     /* 128b/132b */
+
+   /* A burst of bMaxBurst + 1 packets goes out before the sender
+    * waits for the ACK to the last one. */
+   return line * burst * maxp
+      / (burst * (maxp + SS_PACKET_OVERHEAD) + SS_PACKET_OVERHEAD + line * SS_TURNAROUND);
+}
+
+/* Maximum theoretical throughput of an endpoint, in bytes per second,
+ * at the negotiated speed.  Periodic endpoints move at most their bytes
+ * per service interval, bulk endpoints whatever the link leaves over. */
+double usb_endpoint_throughput (struct usb_endpoint_descriptor *ep, struct usb_ss_companion *comp, int speed)
+{
+   int type = ENDPOINT_TYPE(ep);
+   long interval, bytes;
+
+   if (type == USB_ENDPOINT_TYPE_CONTROL || type == USB_ENDPOINT_TYPE_BULK)
+      return bulk_throughput (ENDPOINT_MAXP(ep), comp && comp->present ? comp->bMaxBurst + 1 : 1, speed);
+
+   if (speed >= USB_SPEED_SUPER && comp && comp->present)
+   {
+      bytes = comp->wBytesPerInterval;
+      if (type == USB_ENDPOINT_TYPE_ISOCHRONOUS && SS_COMP_SSP_ISO(comp))
+         bytes = comp->dwBytesPerInterval;
+   }
+   else if (speed == USB_SPEED_HIGH)
+      bytes = ENDPOINT_MAXP(ep) * (ENDPOINT_MULT(ep) + 1);
+   else
+      bytes = ENDPOINT_MAXP(ep);
+
+   interval = usb_endpoint_interval (ep, speed);
+   if (interval <= 0)
+      return 0;
+
+   return bytes * 1e6 / interval;
+}
+
+/* Periodic bytes per second an alternate setting reserves */
+double usb_altsetting_bandwidth (struct usb_interface_descriptor *alt, int speed)
+{
+   struct usb_endpoint_descriptor *ep;
+   struct usb_ss_companion comp;
+   double sum = 0;
+   int i;
+
+   for (i = 0; i < alt->bNumEndpoints; i++)
+   {
+      ep = &alt->endpoint[i];
+      if (ENDPOINT_TYPE(ep) != USB_ENDPOINT_TYPE_INTERRUPT
+          && ENDPOINT_TYPE(ep) != USB_ENDPOINT_TYPE_ISOCHRONOUS)
+         continue;
+
+      usb_endpoint_companion (ep, &comp);
+      sum += usb_endpoint_throughput (ep, &comp, speed);
+   }
+
+   return sum;
+}
+
+/* Bytes per second a bus may reserve for periodic transfers: 90% of a
+ * full speed frame, 80% of a high speed microframe and 90% at
+ * SuperSpeed.  Unknown speed is treated as full speed. */
+double usb_periodic_budget (int speed)
+{
+   if (speed <= USB_SPEED_FULL)
+      return USB_SPEED_FULL * 1e6 / 8 * 0.9;
+   if (speed <= USB_SPEED_HIGH)
+      return speed * 1e6 / 8 * 0.8;
+
+   return speed * 1e6 / 8 * 0.9;
+}
+
+/* Read the BOS descriptor and all its device capabilities into buf.
+ * Returns the number of bytes read, or a negative errno. */
+int usb_get_bos (usb_dev_handle *udev, unsigned char *buf, int len)
+{
+   int ret, total;
+
+   ret = usb_get_descriptor (udev, USB_DT_BOS, 0, buf, 5);
+   if (ret < 5 || buf[1] != USB_DT_BOS)
+      return ret < 0 ? ret : -EIO;
+
+   total = buf[2] | (buf[3] << 8);
+   if (total > len)
+      total = len;
+
+   ret = usb_get_descriptor (udev, USB_DT_BOS, 0, buf, total);
+   if (ret < 5)
+      return ret < 0 ? ret : -EIO;
+
+   return ret;
+}
+
+/* First device capability of the given type, or NULL. */
+unsigned char *usb_bos_find (unsigned char *bos, int len, int type)
+{
+   int pos = bos[0];
+
+   while (pos + 3 <= len && bos[pos] >= 3)
+   {
+      if (bos[pos + 1] == USB_DT_DEVICE_CAPABILITY && bos[pos + 2] == type)
+         return &bos[pos];
+      pos += bos[pos];
+   }
+
+   return NULL;
+}
+
+/* Highest speed, in Mbit/s, the device says it supports.  A SuperSpeed
+ * device on a USB 2.0 port reports bcdUSB 2.10, so the BOS is consulted
+ * for anything newer than 2.0.  A device qualifier is only present on
+ * high-speed capable devices.  Anything else is taken at its word. */
+int usb_device_capability (usb_dev_handle *udev, struct usb_device *dev)
+{
+   unsigned char buf[USB_BOS_SIZE];
+   int len, bcd = dev->descriptor.bcdUSB;
+
+   if (bcd > 0x0200)
+   {
+      len = usb_get_bos (udev, buf, sizeof (buf));
+      if (len > 0 && usb_bos_find (buf, len, USB_CAP_SUPERSPEED_PLUS))
+         return USB_SPEED_SUPER_PLUS;
+      if (len > 0 && usb_bos_find (buf, len, USB_CAP_SUPERSPEED_USB))
+         return USB_SPEED_SUPER;
+   }
+
+   if (bcd >= 0x0300)
+      return USB_SPEED_SUPER;
+
+   if (bcd >= 0x0200
+       && usb_get_descriptor (udev, USB_DT_DEVICE_QUALIFIER, 0, buf, 10) >= 10)
+      return USB_SPEED_HIGH;
+
+   return USB_SPEED_UNKNOWN;
+}
+
+/* The 16 byte Container ID shared by all halves of one physical
+ * device, e.g. the USB 2.0 and SuperSpeed hubs of a USB 3 hub. */
+int usb_get_container_id (usb_dev_handle *udev, unsigned char *id)
+{
+   unsigned char buf[USB_BOS_SIZE], *cap;
+   int len;
+
+   len = usb_get_bos (udev, buf, sizeof (buf));
+   if (len <= 0)
+      return len < 0 ? len : -ENOENT;
+
+   cap = usb_bos_find (buf, len, USB_CAP_CONTAINER_ID);
+   if (!cap || cap[0] < 20)
+      return -ENOENT;
+
+   memcpy (id, &cap[4], 16);
+
+   return 0;
+}
+
+void usb_bos_print (FILE *fp, unsigned char *bos, int len)
+{
+   unsigned char *cap;
+   int pos, i;
+
+   fprintf (fp, "  BOS Descriptor\n");
+   fprintf (fp, "    wTotalLength:       %5u\n", bos[2] | (bos[3] << 8));
+   fprintf (fp, "    bNumDeviceCaps:     %5u\n", bos[4]);
+
+   for (pos = bos[0]; pos + 3 <= len && bos[pos] >= 3; pos += bos[pos])
+   {
+      cap = &bos[pos];
+      if (cap[1] != USB_DT_DEVICE_CAPABILITY)
+         continue;
+
+      switch (cap[2])
+      {
+         case USB_CAP_USB20_EXTENSION:
+            if (cap[0] < 7)
+               break;
+            fprintf (fp, "    USB 2.0 Extension\n");
+            fprintf (fp, "      bmAttributes:  0x%08X%s\n",
+                     cap[3] | (cap[4] << 8) | (cap[5] << 16) | ((unsigned)cap[6] << 24),
+                     cap[3] & 2 ? " LPM" : "");
+            break;
+
+         case USB_CAP_SUPERSPEED_USB:
+            if (cap[0] < 10)
+               break;
+            fprintf (fp, "    SuperSpeed USB\n");
+            fprintf (fp, "      bmAttributes:          0x%02X%s\n", cap[3],
+                     cap[3] & 2 ? " LTM" : "");
+            fprintf (fp, "      wSpeedsSupported:    0x%04X\n", cap[4] | (cap[5] << 8));
+            fprintf (fp, "      bFunctionalitySupport: %3u\n", cap[6]);
+            fprintf (fp, "      bU1DevExitLat:       %5u us\n", cap[7]);
+            fprintf (fp, "      bU2DevExitLat:       %5u us\n", cap[8] | (cap[9] << 8));
+            break;
+
+         case USB_CAP_CONTAINER_ID:
+            if (cap[0] < 20)
+               break;
+            fprintf (fp, "    Container ID:  ");
+            for (i = 4; i < 20; i++)
+               fprintf (fp, "%02X%s", cap[i], i == 7 || i == 9 || i == 11 || i == 13 ? "-" : "");
+            fprintf (fp, "\n");
+            break;
+
+         case USB_CAP_SUPERSPEED_PLUS:
+            if (cap[0] < 12)
+               break;
+            fprintf (fp, "    SuperSpeedPlus USB\n");
+            fprintf (fp, "      Sublink Speed Attributes: %u\n", (cap[4] & 0x1f) + 1);
+            fprintf (fp, "      Min Lanes Rx/Tx:          %u/%u\n",
+                     cap[9] & 0x0f, cap[9] >> 4);
+            break;
+
+         default:
+            fprintf (fp, "    Device Capability 0x%02X, %u bytes\n", cap[2], cap[0]);
+            break;
+      }
+   }
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,76 @@
+/* usbdesc.h  --  Descriptor decoding helpers.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBDESC_H
+#define _USBDESC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <usb.h>
+
+#define USB_DT_DEVICE_QUALIFIER      0x06
+#define USB_DT_BOS                   0x0f
+#define USB_DT_DEVICE_CAPABILITY     0x10
+#define USB_DT_SS_ENDPOINT_COMP      0x30
+#define USB_DT_SSP_ISOC_ENDPOINT_COMP 0x31
+
+/* BOS device capability types */
+#define USB_CAP_USB20_EXTENSION      0x02
+#define USB_CAP_SUPERSPEED_USB       0x03
+#define USB_CAP_CONTAINER_ID         0x04
+#define USB_CAP_SUPERSPEED_PLUS      0x0a
+
+#define USB_BOS_SIZE                 1024
+
+#define ENDPOINT_TYPE(ep)  ((ep)->bmAttributes & USB_ENDPOINT_TYPE_MASK)
+#define ENDPOINT_IS_IN(ep) ((ep)->bEndpointAddress & USB_ENDPOINT_DIR_MASK)
+#define ENDPOINT_MAXP(ep)  ((ep)->wMaxPacketSize & 0x7ff)
+#define ENDPOINT_MULT(ep)  (((ep)->wMaxPacketSize >> 11) & 3)
+
+/* SuperSpeed endpoint companion, plus the SuperSpeedPlus isochronous
+ * companion when the endpoint has one. */
+struct usb_ss_companion
+{
+   int      present;
+   uint8_t  bMaxBurst;
+   uint8_t  bmAttributes;
+   uint16_t wBytesPerInterval;
+   uint32_t dwBytesPerInterval;
+};
+
+#define SS_COMP_STREAMS(c) ((c)->bmAttributes & 0x1f)
+#define SS_COMP_MULT(c)    ((c)->bmAttributes & 3)
+#define SS_COMP_SSP_ISO(c) ((c)->bmAttributes & 0x80)
+
+struct usb_endpoint_descriptor *usb_find_endpoint (struct usb_interface_descriptor *alt, int address);
+long usb_endpoint_interval (struct usb_endpoint_descriptor *ep, int speed);
+
+int    usb_endpoint_companion (struct usb_endpoint_descriptor *ep, struct usb_ss_companion *comp);
+double usb_endpoint_throughput (struct usb_endpoint_descriptor *ep, struct usb_ss_companion *comp, int speed);
+double usb_altsetting_bandwidth (struct usb_interface_descriptor *alt, int speed);
+double usb_periodic_budget (int speed);
+
+int usb_get_bos (usb_dev_handle *udev, unsigned char *buf, int len);
+unsigned char *usb_bos_find (unsigned char *bos, int len, int type);
+int usb_device_capability (usb_dev_handle *udev, struct usb_device *dev);
+int usb_get_container_id (usb_dev_handle *udev, unsigned char *id);
+void usb_bos_print (FILE *fp, unsigned char *bos, int len);
+
+#endif /* _USBDESC_H */
@@ -0,0 +1,446 @@
+/* usbevent.c  --  Hotplug uevent listener and event journal.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "error.h"
+#include "usbevent.h"
+#include "usbstat.h"
+
+extern int usb_debug;
+
+/* Attaches waiting for their driver, oldest is reused when full */
+#define PENDING_MAX 256
+
+static const char *action_name[] = { "?", "add", "bind", "unbind", "remove" };
+
+/* Map a journal file, creating it if needed.  Without a file the
+ * journal only lives in memory for the duration of the run.  A
+ * readonly journal must already exist and is never modified. */
+int usb_journal_open (const char *file, int readonly, struct usb_journal *journal)
+{
+   struct usb_journal_header *hdr;
+   struct stat st;
+   size_t size;
+   int fd = -1, flags = MAP_SHARED, prot = PROT_READ | PROT_WRITE;
+   void *map;
+
+   memset (journal, 0, sizeof (*journal));
+   journal->fd = -1;
+   size = sizeof (*hdr) + USB_JOURNAL_SIZE * sizeof (struct usb_event);
+
+   if (file)
+   {
+      if (readonly)
+         fd = open (file, O_RDONLY);
+      else
+         fd = open (file, O_RDWR | O_CREAT, 0644);
+      if (fd < 0 || fstat (fd, &st))
+      {
+         if (fd >= 0)
+            close (fd);
+         USB_ERROR_STR(-errno, "could not open journal %s: %s", file, strerror(errno));
+      }
+
+      if (st.st_size == 0 && !readonly)
+      {
+         if (ftruncate (fd, size))
+         {
+            close (fd);
+            USB_ERROR_STR(-errno, "could not create journal %s: %s", file, strerror(errno));
+         }
+      }
+      else
+      {
+         /* Never map past the end of the file */
+         size = st.st_size;
+      }
+
+      if (size < sizeof (*hdr))
+      {
+         close (fd);
+         USB_ERROR_STR(-EINVAL, "%s is not a version %d journal", file, USB_JOURNAL_VERSION);
+      }
+      if (readonly)
+         prot = PROT_READ;
+   }
+   else
+   {
+      flags |= MAP_ANONYMOUS;
+   }
+
+   map = mmap (NULL, size, prot, flags, fd, 0);
+   if (map == MAP_FAILED)
+   {
+      if (fd >= 0)
+         close (fd);
+      USB_ERROR_STR(-errno, "could not map journal: %s", strerror(errno));
+   }
+
+   hdr = map;
+   if (!hdr->magic && !readonly)
+   {
+      hdr->magic    = USB_JOURNAL_MAGIC;
+      hdr->version  = USB_JOURNAL_VERSION;
+      hdr->capacity = USB_JOURNAL_SIZE;
+   }
+
+   if (hdr->magic != USB_JOURNAL_MAGIC || hdr->version != USB_JOURNAL_VERSION
+       || !hdr->capacity
+       || sizeof (*hdr) + (uint64_t)hdr->capacity * sizeof (struct usb_event) > size)
+   {
+      munmap (map, size);
+      if (fd >= 0)
+         close (fd);
+      USB_ERROR_STR(-EINVAL, "%s is not a version %d journal", file, USB_JOURNAL_VERSION);
+   }
+
+   /* Appends are serialized on the file, readers need no lock */
+   if (readonly && fd >= 0)
+   {
+      close (fd);
+      fd = -1;
+   }
+
+   journal->fd   = fd;
+   journal->hdr  = hdr;
+   journal->rec  = (struct usb_event *)(hdr + 1);
+   journal->size = size;
+
+   return 0;
+}
+
+void usb_journal_close (struct usb_journal *journal)
+{
+   if (journal->hdr)
+      munmap (journal->hdr, journal->size);
+   if (journal->fd >= 0)
+      close (journal->fd);
+   memset (journal, 0, sizeof (*journal));
+   journal->fd = -1;
+}
+
+/* Append-only ring, several writers may share the same file.  The
+ * slot is taken under flock() on the file, the record is written
+ * before head moves past it. */
+void usb_journal_append (struct usb_journal *journal, const struct usb_event *ev)
+{
+   uint64_t slot;
+
+   if (journal->fd >= 0)
+      flock (journal->fd, LOCK_EX);
+
+   slot = journal->hdr->head;
+   journal->rec[slot % journal->hdr->capacity] = *ev;
+   journal->hdr->head = slot + 1;
+
+   if (journal->fd >= 0)
+      flock (journal->fd, LOCK_UN);
+}
+
+struct pending
+{
+   char     name[24];
+   uint64_t mono;
+   uint16_t vid, pid;
+   int      used, bound, ready;
+};
+
+struct latency
+{
+   uint16_t vid, pid;
+   int attaches;
+   struct usb_stat bind, ready;
+};
+
+static struct latency *latency_get (struct latency **list, int *num, uint16_t vid, uint16_t pid)
+{
+   struct latency *tmp;
+   int i;
+
+   for (i = 0; i < *num; i++)
+   {
+      if ((*list)[i].vid == vid && (*list)[i].pid == pid)
+         return &(*list)[i];
+   }
+
+   tmp = realloc (*list, (*num + 1) * sizeof (struct latency));
+   if (!tmp)
+      return NULL;
+   *list = tmp;
+
+   tmp = &(*list)[(*num)++];
+   memset (tmp, 0, sizeof (*tmp));
+   tmp->vid = vid;
+   tmp->pid = pid;
+   usb_stat_init (&tmp->bind);
+   usb_stat_init (&tmp->ready);
+
+   return tmp;
+}
+
+/* Latencies per VID/PID from the records in the journal, measured from
+ * the device's add event, which the kernel sends once enumeration is
+ * done: add-to-bind until the usb core binds to the device, add-to-ready
+ * until the first of its interfaces gets a driver.  Records from before
+ * a reboot have an unrelated monotonic clock and are ignored. */
+void usb_journal_report (FILE *fp, struct usb_journal *journal)
+{
+   struct pending pending[PENDING_MAX];
+   struct latency *lat = NULL, *l;
+   struct usb_event *ev;
+   uint64_t i, first, head;
+   char name[24], *p;
+   int j, num = 0, next = 0;
+
+   memset (pending, 0, sizeof (pending));
+
+   head  = journal->hdr->head;
+   first = head > journal->hdr->capacity ? head - journal->hdr->capacity : 0;
+   for (i = first; i < head; i++)
+   {
+      ev = &journal->rec[i % journal->hdr->capacity];
+
+      strncpy (name, ev->name, sizeof (name) - 1);
+      name[sizeof (name) - 1] = 0;
+      p = strchr (name, ':');
+      if (p)
+         *p = 0;
+
+      for (j = 0; j < PENDING_MAX; j++)
+      {
+         if (pending[j].used && !strcmp (pending[j].name, name))
+            break;
+      }
+
+      if (ev->type == USB_EVENT_DEVICE && ev->action == USB_EVENT_ADD)
+      {
+         if (j == PENDING_MAX)
+         {
+            j = next;
+            next = (next + 1) % PENDING_MAX;
+         }
+         memset (&pending[j], 0, sizeof (pending[j]));
+         strcpy (pending[j].name, name);
+         pending[j].used = 1;
+         pending[j].mono = ev->mono;
+         pending[j].vid = ev->vid;
+         pending[j].pid = ev->pid;
+
+         l = latency_get (&lat, &num, ev->vid, ev->pid);
+         if (l)
+            l->attaches++;
+         continue;
+      }
+
+      if (j == PENDING_MAX)
+         continue;
+
+      if (ev->action == USB_EVENT_REMOVE && ev->type == USB_EVENT_DEVICE)
+      {
+         pending[j].used = 0;
+         continue;
+      }
+      if (ev->action != USB_EVENT_BIND || ev->mono < pending[j].mono)
+         continue;
+
+      l = latency_get (&lat, &num, pending[j].vid, pending[j].pid);
+      if (!l)
+         continue;
+
+      if (ev->type == USB_EVENT_DEVICE && !pending[j].bound)
+      {
+         usb_stat_add (&l->bind, (ev->mono - pending[j].mono) / 1000000.0);
+         pending[j].bound = 1;
+      }
+      if (ev->type == USB_EVENT_INTERFACE && !pending[j].ready)
+      {
+         usb_stat_add (&l->ready, (ev->mono - pending[j].mono) / 1000000.0);
+         pending[j].ready = 1;
+      }
+   }
+
+   for (j = 0; j < num; j++)
+   {
+      l = &lat[j];
+      fprintf (fp, "ID:%04X/%04X attaches:%d\n", l->vid, l->pid, l->attaches);
+      if (l->bind.num)
+      {
+         fprintf (fp, "  add-to-bind:  ");
+         usb_stat_print (fp, &l->bind, "ms");
+         fprintf (fp, "\n");
+      }
+      if (l->ready.num)
+      {
+         fprintf (fp, "  add-to-ready: ");
+         usb_stat_print (fp, &l->ready, "ms");
+         fprintf (fp, "\n");
+      }
+      usb_stat_free (&l->bind);
+      usb_stat_free (&l->ready);
+   }
+   free (lat);
+}
+
+/* Listen to kernel uevents, with room for a burst of events. */
+int usb_event_open (void)
+{
+   struct sockaddr_nl addr;
+   int sd, size = 1024 * 1024;
+
+   sd = socket (AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+   if (sd < 0)
+   {
+      USB_ERROR_STR(-errno, "could not open uevent socket: %s", strerror(errno));
+   }
+
+   setsockopt (sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+   memset (&addr, 0, sizeof (addr));
+   addr.nl_family = AF_NETLINK;
+   addr.nl_pid    = 0;
+   addr.nl_groups = 1;
+   if (bind (sd, (struct sockaddr *)&addr, sizeof (addr)))
+   {
+      close (sd);
+      USB_ERROR_STR(-errno, "could not bind uevent socket: %s", strerror(errno));
+   }
+
+   return sd;
+}
+
+/* Receive one uevent.  Returns 0 for a USB device or interface event
+ * in ev, 1 for events we do not care about, or -errno. */
+int usb_event_read (int sd, struct usb_event *ev)
+{
+   char buf[8192], *p, *end, *val;
+   struct timespec now;
+   unsigned int a, b, c;
+   ssize_t len;
+   int usb = 0;
+
+   len = recv (sd, buf, sizeof (buf) - 1, 0);
+   if (len < 0)
+      return -errno;
+   buf[len] = 0;
+
+   memset (ev, 0, sizeof (*ev));
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   ev->mono = now.tv_sec * 1000000000ULL + now.tv_nsec;
+   clock_gettime (CLOCK_REALTIME, &now);
+   ev->ns = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+   /* "action@devpath" followed by KEY=VALUE strings */
+   end = buf + len;
+   for (p = buf + strlen (buf) + 1; p < end; p += strlen (p) + 1)
+   {
+      val = strchr (p, '=');
+      if (!val)
+         continue;
+      val++;
+
+      if (!strncmp (p, "ACTION=", 7))
+      {
+         for (a = USB_EVENT_ADD; a <= USB_EVENT_REMOVE; a++)
+         {
+            if (!strcmp (val, action_name[a]))
+               ev->action = a;
+         }
+      }
+      else if (!strncmp (p, "SUBSYSTEM=", 10))
+         usb = !strcmp (val, "usb");
+      else if (!strncmp (p, "DEVTYPE=", 8))
+      {
+         if (!strcmp (val, "usb_device"))
+            ev->type = USB_EVENT_DEVICE;
+         else if (!strcmp (val, "usb_interface"))
+            ev->type = USB_EVENT_INTERFACE;
+      }
+      else if (!strncmp (p, "DEVPATH=", 8))
+      {
+         val = strrchr (val, '/');
+         if (val)
+            strncpy (ev->name, val + 1, sizeof (ev->name) - 1);
+      }
+      else if (!strncmp (p, "PRODUCT=", 8) && sscanf (val, "%x/%x/%x", &a, &b, &c) == 3)
+      {
+         ev->vid = a;
+         ev->pid = b;
+         ev->bcd = c;
+      }
+      else if ((!strncmp (p, "INTERFACE=", 10) || !strncmp (p, "TYPE=", 5))
+               && sscanf (val, "%u/%u/%u", &a, &b, &c) == 3)
+      {
+         ev->cls    = a;
+         ev->subcls = b;
+         ev->proto  = c;
+      }
+      else if (!strncmp (p, "BUSNUM=", 7))
+         ev->busnum = atoi (val);
+      else if (!strncmp (p, "DEVNUM=", 7))
+         ev->devnum = atoi (val);
+      else if (!strncmp (p, "DRIVER=", 7))
+         strncpy (ev->driver, val, sizeof (ev->driver) - 1);
+   }
+
+   if (!usb || !ev->action || !ev->type)
+      return 1;
+
+   return 0;
+}
+
+void usb_event_print (FILE *fp, const struct usb_event *ev)
+{
+   struct tm tm;
+   time_t sec = ev->ns / 1000000000ULL;
+
+   localtime_r (&sec, &tm);
+   fprintf (fp, "%02d:%02d:%02d.%06u %-6s %-9s %-12s",
+            tm.tm_hour, tm.tm_min, tm.tm_sec, (unsigned)(ev->ns % 1000000000ULL / 1000),
+            action_name[ev->action < 5 ? ev->action : 0],
+            ev->type == USB_EVENT_DEVICE ? "device" : "interface", ev->name);
+   if (ev->busnum)
+      fprintf (fp, " Bus:%03u Dev:%03u", ev->busnum, ev->devnum);
+   fprintf (fp, " ID:%04X/%04X/%04X", ev->vid, ev->pid, ev->bcd);
+   if (ev->driver[0])
+      fprintf (fp, " Driver:%.16s", ev->driver);
+   fprintf (fp, "\n");
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,84 @@
+/* usbevent.h  --  Hotplug uevent listener and event journal.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBEVENT_H
+#define _USBEVENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define USB_JOURNAL_FILE     "/var/log/usbctl.journal"
+#define USB_JOURNAL_MAGIC    0x4a534255    /* "UBSJ" */
+#define USB_JOURNAL_VERSION  2
+#define USB_JOURNAL_SIZE     4096          /* records */
+
+enum {
+   USB_EVENT_ADD = 1,
+   USB_EVENT_BIND,
+   USB_EVENT_UNBIND,
+   USB_EVENT_REMOVE
+};
+
+enum {
+   USB_EVENT_DEVICE = 1,
+   USB_EVENT_INTERFACE
+};
+
+/* One fixed size, 72 byte, journal record */
+struct usb_event
+{
+   uint64_t ns;                 /* CLOCK_REALTIME, for display */
+   uint64_t mono;               /* CLOCK_MONOTONIC, for latencies */
+   uint8_t  action, type;
+   uint8_t  busnum, devnum;
+   uint16_t vid, pid, bcd;
+   uint8_t  cls, subcls, proto;
+   uint8_t  reserved;
+   char     name[24];           /* sysfs name, e.g. 1-1.2:1.0 */
+   char     driver[16];
+};
+
+struct usb_journal_header
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t capacity;
+   uint32_t reserved;
+   uint64_t head;               /* total records ever written */
+};
+
+struct usb_journal
+{
+   struct usb_journal_header *hdr;
+   struct usb_event *rec;
+   size_t size;
+   int fd;                      /* locked while appending, -1 in memory */
+};
+
+int  usb_journal_open (const char *file, int readonly, struct usb_journal *journal);
+void usb_journal_close (struct usb_journal *journal);
+void usb_journal_append (struct usb_journal *journal, const struct usb_event *ev);
+void usb_journal_report (FILE *fp, struct usb_journal *journal);
+
+int  usb_event_open (void);
+int  usb_event_read (int sd, struct usb_event *ev);
+void usb_event_print (FILE *fp, const struct usb_event *ev);
+
+#endif /* _USBEVENT_H */
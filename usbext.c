@@ -19,7 +19,9 @@
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef HAVE_CONFIG_H
@@ -28,15 +30,32 @@
 
 #include "error.h"
 #include "usbext.h"
+#include "usbdesc.h"
+#include "usblock.h"
+#include "usbsysfs.h"
 
+/* Claim the device's first interface.  Other usbctl processes wanting
+ * the same device queue up behind us, see usblock.c.  The lock rides
+ * along in the handle until usb_release_device(). */
 struct usb_dev_handle *usb_claim_device (struct usb_device *dev)
 {
    int result;
    struct usb_dev_handle *udev;
+   struct usb_lock *lock;
+
+   lock = malloc (sizeof (*lock));
+   if (!lock)
+      return NULL;
+   if (usb_lock_acquire (dev, usb_lock_timeout, lock))
+   {
+      free (lock);
+      return NULL;
+   }
 
    udev = usb_open(dev);
    if (udev)
    {
+      ((struct usb_dev_handle_ext *)udev)->impl_info = lock;
 #ifdef LIBUSB_HAS_GET_DRIVER_NP
       result = usb_detach_kernel_driver_np (udev, INTERFACE_NUMBER(dev));
       if (result) goto exit;
@@ -47,17 +66,153 @@ struct usb_dev_handle *usb_claim_device (struct usb_device *dev)
       return udev;
    }
   exit:
-   usb_close(udev);
+   if (udev)
+      usb_close(udev);
+   usb_lock_release (lock);
+   free (lock);
 
    return NULL;
 }
 
 int usb_release_device (struct usb_dev_handle *udev)
 {
+   struct usb_lock *lock = ((struct usb_dev_handle_ext *)udev)->impl_info;
+   int result;
+
    usb_release_interface (udev, INTERFACE_NUMBER(usb_device(udev)));
    usb_reattach_kernel_driver_np (udev, INTERFACE_NUMBER(usb_device(udev)));
 
-   return usb_close(udev);
+   result = usb_close(udev);
+   if (lock)
+   {
+      usb_lock_release (lock);
+      free (lock);
+   }
+
+   return result;
+}
+
+/* Select an alternate setting for the claimed interface by periodic
+ * bandwidth.  USB_ALTSETTING_AUTO picks the most bandwidth that fits
+ * what the rest of the bus leaves free, or with a rate the least that
+ * still reaches it.  A setting the host controller rejects falls back
+ * to the next lower bandwidth, and finally to setting 0.  A setting
+ * given by number is applied as is or not at all.  Returns the
+ * setting applied. */
+int usb_select_altinterface (usb_dev_handle *udev, int want, double rate)
+{
+   struct usb_device *dev = usb_device (udev);
+   struct usb_interface *intf;
+   char path[PATH_MAX + 1];
+   double *bw, avail;
+   int *order, *tried;
+   int i, k, num, n = 0, pick = -1, result = -ENODEV, speed = USB_SPEED_UNKNOWN;
+
+   if (!dev->config || !dev->config->interface || !dev->config->interface->num_altsetting)
+   {
+      USB_ERROR_STR(-ENODEV, "no interface to select a setting on");
+   }
+   intf = dev->config->interface;
+   num  = intf->num_altsetting;
+
+   bw    = calloc (num, sizeof (double));
+   order = calloc (num + 1, sizeof (int));
+   tried = calloc (num, sizeof (int));
+   if (!bw || !order || !tried)
+   {
+      free (bw);
+      free (order);
+      free (tried);
+      USB_ERROR(-ENOMEM);
+   }
+
+   if (!usb_sysfs_path (dev, path, sizeof (path)))
+      speed = usb_sysfs_speed (path);
+   avail = usb_periodic_budget (speed) - usb_sysfs_periodic_used (dev);
+   for (i = 0; i < num; i++)
+      bw[i] = usb_altsetting_bandwidth (&intf->altsetting[i], speed);
+
+   for (i = 0; i < num; i++)
+   {
+      if (want >= 0)
+      {
+         if (intf->altsetting[i].bAlternateSetting == want)
+            pick = i;
+         continue;
+      }
+      if (bw[i] > avail)
+         continue;
+
+      if (pick < 0
+          || (rate > 0 && bw[i] >= rate && (bw[pick] < rate || bw[i] < bw[pick]))
+          || ((rate <= 0 || bw[pick] < rate) && bw[i] > bw[pick]))
+         pick = i;
+   }
+
+   if (want >= 0 && pick < 0)
+   {
+      free (bw);
+      free (order);
+      free (tried);
+      USB_ERROR_STR(-EINVAL, "no alternate setting %d on interface %d", want,
+                    intf->altsetting[0].bInterfaceNumber);
+   }
+
+   /* Nothing fits, setting 0 is the one that should */
+   for (i = 0; pick < 0 && i < num; i++)
+   {
+      if (intf->altsetting[i].bAlternateSetting == 0)
+         pick = i;
+   }
+
+   /* The pick first, then what is cheaper, most bandwidth first.  A
+    * setting asked for by number is the only one tried. */
+   if (pick >= 0)
+   {
+      order[n++] = pick;
+      tried[pick] = 1;
+   }
+   while (want < 0)
+   {
+      k = -1;
+      for (i = 0; i < num; i++)
+      {
+         if (tried[i] || (pick >= 0 && bw[i] > bw[pick]))
+            continue;
+         if (k < 0 || bw[i] > bw[k])
+            k = i;
+      }
+      if (k < 0)
+         break;
+      order[n++] = k;
+      tried[k] = 1;
+   }
+   for (i = 0; want < 0 && i < num; i++)
+   {
+      if (!tried[i] && intf->altsetting[i].bAlternateSetting == 0)
+         order[n++] = i;
+   }
+
+   for (i = 0; i < n; i++)
+   {
+      result = usb_set_altinterface (udev, intf->altsetting[order[i]].bAlternateSetting);
+      if (!result)
+      {
+         result = intf->altsetting[order[i]].bAlternateSetting;
+         break;
+      }
+   }
+
+   free (bw);
+   free (order);
+   free (tried);
+   if (result < 0)
+   {
+      USB_ERROR_STR(result, "no alternate setting of interface %d accepted: %s",
+                    intf->altsetting[0].bInterfaceNumber, strerror(-result));
+   }
+
+   return result;
 }
 
 /* Reattach kernel driver. */
@@ -82,6 +237,62 @@ int usb_reattach_kernel_driver_np(usb_dev_handle *udev, int interface)
    return 0;
 }
 
+int usb_get_fd_np(usb_dev_handle *udev)
+{
+   return ((struct usb_dev_handle_ext *)udev)->fd;
+}
+
+/* Queue an URB, libusb 0.1 only does synchronous transfers. */
+int usb_submit_urb_np(usb_dev_handle *udev, struct usb_urb_ext *urb)
+{
+   urb->status = 0;
+   urb->actual_length = 0;
+   urb->signr = 0;
+
+   if (ioctl(usb_get_fd_np(udev), IOCTL_USB_SUBMITURB, urb))
+      USB_ERROR(-errno);
+
+   return 0;
+}
+
+/* Reap one completed URB, waiting at most timeout ms, or forever if
+ * timeout is negative.  Returns -ETIMEDOUT if nothing completed. */
+int usb_reap_urb_np(usb_dev_handle *udev, struct usb_urb_ext **urb, int timeout)
+{
+   struct pollfd pfd;
+   int fd = usb_get_fd_np(udev);
+
+   while (ioctl(fd, IOCTL_USB_REAPURBNDELAY, urb))
+   {
+      if (errno != EAGAIN)
+         USB_ERROR(-errno);
+
+      /* usbfs signals completed URBs as writable. */
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      switch (poll(&pfd, 1, timeout))
+      {
+         case -1:
+            if (errno != EINTR)
+               USB_ERROR(-errno);
+            break;
+
+         case 0:
+            USB_ERROR(-ETIMEDOUT);
+      }
+   }
+
+   return 0;
+}
+
+int usb_discard_urb_np(usb_dev_handle *udev, struct usb_urb_ext *urb)
+{
+   if (ioctl(usb_get_fd_np(udev), IOCTL_USB_DISCARDURB, urb))
+      USB_ERROR(-errno);
+
+   return 0;
+}
+
 /**
  * Local Variables:
  *  c-file-style: "ellemtel"
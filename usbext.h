@@ -45,18 +45,53 @@ struct usb_dev_handle_ext {
   int interface;
   int altsetting;
 
-  /* Added by RMT so implementations can store other per-open-device data */
+  /* Added by RMT so implementations can store other per-open-device data.
+   * libusb's Linux backend leaves it unused, usbctl keeps the device lock
+   * of usb_claim_device() here, see usb_release_device(). */
   void *impl_info;
 };
 
+/* Actually struct usbdevfs_urb from the kernel, for queued transfers */
+#define USB_URB_TYPE_ISO              0
+#define USB_URB_TYPE_INTERRUPT        1
+#define USB_URB_TYPE_CONTROL          2
+#define USB_URB_TYPE_BULK             3
+
+struct usb_urb_ext {
+  unsigned char type;
+  unsigned char endpoint;
+  int status;
+  unsigned int flags;
+  void *buffer;
+  int buffer_length;
+  int actual_length;
+  int start_frame;
+  int number_of_packets;
+  int error_count;
+  unsigned int signr;  /* signal to be sent on error, -1 if none should be sent */
+  void *usercontext;
+};
+
 extern int usb_debug;
 
 
 #define IOCTL_USB_IOCTL         _IOWR('U', 18, struct usb_ioctl)
 #define IOCTL_USB_CONNECT       _IO('U', 23)
+#define IOCTL_USB_SUBMITURB     _IOR('U', 10, struct usb_urb_ext)
+#define IOCTL_USB_DISCARDURB    _IO('U', 11)
+#define IOCTL_USB_REAPURB       _IOW('U', 12, void *)
+#define IOCTL_USB_REAPURBNDELAY _IOW('U', 13, void *)
 
 struct usb_dev_handle *usb_claim_device (struct usb_device *dev);
 int usb_release_device (struct usb_dev_handle *udev);
 int usb_reattach_kernel_driver_np(usb_dev_handle *udev, int interface);
 
+#define USB_ALTSETTING_AUTO  -1
+int usb_select_altinterface (usb_dev_handle *udev, int want, double rate);
+
+int usb_get_fd_np(usb_dev_handle *udev);
+int usb_submit_urb_np(usb_dev_handle *udev, struct usb_urb_ext *urb);
+int usb_reap_urb_np(usb_dev_handle *udev, struct usb_urb_ext **urb, int timeout);
+int usb_discard_urb_np(usb_dev_handle *udev, struct usb_urb_ext *urb);
+
 #endif /* _USBEXT_H */
@@ -0,0 +1,118 @@
+/* usbhub.c  --  Hub class requests.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "usbhub.h"
+
+#define HUB_TIMEOUT 1000
+
+static const char *link_state[] = {
+   "U0", "U1", "U2", "U3", "SS.Disabled", "Rx.Detect", "SS.Inactive", "Polling",
+   "Recovery", "Hot Reset", "Compliance", "Loopback", "(12)", "(13)", "(14)", "(15)"
+};
+
+/* Number of downstream ports, from the hub descriptor */
+int usb_hub_nports (usb_dev_handle *udev, int superspeed)
+{
+   unsigned char buf[16];
+   int ret;
+
+   ret = usb_control_msg (udev, USB_ENDPOINT_IN | USB_TYPE_CLASS | USB_RECIP_DEVICE,
+                          USB_REQ_GET_DESCRIPTOR,
+                          (superspeed ? USB_DT_SS_HUB : USB_DT_HUB) << 8, 0,
+                          (char *)buf, sizeof (buf), HUB_TIMEOUT);
+   if (ret < 3)
+      return ret < 0 ? ret : -EIO;
+
+   return buf[2];
+}
+
+int usb_hub_port_status (usb_dev_handle *udev, int port, struct usb_port_status *st)
+{
+   unsigned char buf[4];
+   int ret;
+
+   ret = usb_control_msg (udev, USB_ENDPOINT_IN | USB_TYPE_CLASS | USB_RECIP_OTHER,
+                          USB_REQ_GET_STATUS, 0, port, (char *)buf, sizeof (buf),
+                          HUB_TIMEOUT);
+   if (ret < 4)
+      return ret < 0 ? ret : -EIO;
+
+   st->status = buf[0] | (buf[1] << 8);
+   st->change = buf[2] | (buf[3] << 8);
+
+   return 0;
+}
+
+int usb_hub_port_feature (usb_dev_handle *udev, int port, int feature, int set)
+{
+   int ret;
+
+   ret = usb_control_msg (udev, USB_TYPE_CLASS | USB_RECIP_OTHER,
+                          set ? USB_REQ_SET_FEATURE : USB_REQ_CLEAR_FEATURE,
+                          feature, port, NULL, 0, HUB_TIMEOUT);
+
+   return ret < 0 ? ret : 0;
+}
+
+void usb_hub_port_print (FILE *fp, struct usb_port_status *st, int superspeed)
+{
+   uint16_t s = st->status;
+
+   fprintf (fp, "%s", s & USB_PORT_STAT_CONNECTION ? "connected" : "empty");
+   if (s & USB_PORT_STAT_ENABLE)
+      fprintf (fp, " enabled");
+   if (s & USB_PORT_STAT_SUSPEND)
+      fprintf (fp, " suspended");
+   if (s & USB_PORT_STAT_OVERCURRENT)
+      fprintf (fp, " over-current");
+   if (s & USB_PORT_STAT_RESET)
+      fprintf (fp, " reset");
+
+   if (superspeed)
+   {
+      fprintf (fp, "%s %s", s & USB_SS_PORT_STAT_POWER ? " power" : " off",
+               link_state[(s & USB_PORT_STAT_LINK_STATE) >> 5]);
+      if (s & USB_PORT_STAT_CONNECTION)
+         fprintf (fp, " %s", (s & USB_SS_PORT_STAT_SPEED) ? "super-speed-plus" : "super-speed");
+   }
+   else
+   {
+      fprintf (fp, "%s", s & USB_PORT_STAT_POWER ? " power" : " off");
+      if (s & USB_PORT_STAT_CONNECTION)
+         fprintf (fp, " %s", s & USB_PORT_STAT_LOW_SPEED ? "low-speed"
+                  : s & USB_PORT_STAT_HIGH_SPEED ? "high-speed" : "full-speed");
+   }
+
+   if (st->change)
+      fprintf (fp, " change:0x%04X", st->change);
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
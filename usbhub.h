@@ -0,0 +1,64 @@
+/* usbhub.h  --  Hub class requests.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBHUB_H
+#define _USBHUB_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <usb.h>
+
+#define USB_DT_SS_HUB                0x2a
+
+/* wPortStatus */
+#define USB_PORT_STAT_CONNECTION     0x0001
+#define USB_PORT_STAT_ENABLE         0x0002
+#define USB_PORT_STAT_SUSPEND        0x0004
+#define USB_PORT_STAT_OVERCURRENT    0x0008
+#define USB_PORT_STAT_RESET          0x0010
+#define USB_PORT_STAT_POWER          0x0100
+#define USB_PORT_STAT_LOW_SPEED      0x0200
+#define USB_PORT_STAT_HIGH_SPEED     0x0400
+#define USB_PORT_STAT_LINK_STATE     0x01e0   /* SuperSpeed hubs */
+#define USB_SS_PORT_STAT_POWER       0x0200
+#define USB_SS_PORT_STAT_SPEED       0x1c00
+
+/* Port features */
+#define USB_PORT_FEAT_ENABLE         1
+#define USB_PORT_FEAT_RESET          4
+#define USB_PORT_FEAT_POWER          8
+#define USB_PORT_FEAT_C_CONNECTION   16
+
+#define USB_IS_HUB(dev)     ((dev)->descriptor.bDeviceClass == USB_CLASS_HUB)
+#define USB_IS_SS_HUB(dev)  (USB_IS_HUB(dev) && (dev)->descriptor.bcdUSB >= 0x0300 \
+                             && (dev)->descriptor.bDeviceProtocol == 3)
+
+struct usb_port_status
+{
+   uint16_t status;
+   uint16_t change;
+};
+
+int  usb_hub_nports (usb_dev_handle *udev, int superspeed);
+int  usb_hub_port_status (usb_dev_handle *udev, int port, struct usb_port_status *st);
+int  usb_hub_port_feature (usb_dev_handle *udev, int port, int feature, int set);
+void usb_hub_port_print (FILE *fp, struct usb_port_status *st, int superspeed);
+
+#endif /* _USBHUB_H */
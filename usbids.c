@@ -0,0 +1,510 @@
+/* usbids.c  --  Constant time name lookup from a compiled usb.ids.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "error.h"
+#include "usbids.h"
+
+extern int usb_debug;
+
+#define ALIGN8(x) (((x) + 7) & ~7)
+
+/* Key type, stored in the upper 32 bits so that no key is ever 0. */
+#define IDS_VENDOR    1
+#define IDS_PRODUCT   2
+#define IDS_CLASS     3
+#define IDS_SUBCLASS  4
+#define IDS_PROTOCOL  5
+
+#define IDS_KEY(type, val) (((uint64_t)(type) << 32) | (uint32_t)(val))
+
+/* Give up on a bucket after this many displacements and grow the table. */
+#define IDS_MAX_DISP  (1 << 20)
+
+struct ids_entry
+{
+   uint64_t key;
+   uint32_t name;
+   uint32_t bucket;
+};
+
+static struct
+{
+   char    *map;
+   size_t   size;
+   const struct usb_ids_header *hdr;
+   const uint32_t *disp;
+   const uint64_t *keys;
+   const uint32_t *names;
+   const char     *str;
+} ids;
+
+static uint64_t ids_hash (uint64_t key, uint32_t seed)
+{
+   key ^= (uint64_t)seed * 0x9e3779b97f4a7c15ULL;
+   key ^= key >> 33;
+   key *= 0xff51afd7ed558ccdULL;
+   key ^= key >> 33;
+   key *= 0xc4ceb9fe1a85ec53ULL;
+   key ^= key >> 33;
+
+   return key;
+}
+
+/* Names are pooled in file order, so on equal keys their offset keeps
+ * the sort stable. */
+static int ids_cmp_key (const void *a, const void *b)
+{
+   const struct ids_entry *x = a, *y = b;
+
+   if (x->key != y->key)
+      return x->key < y->key ? -1 : 1;
+
+   return x->name < y->name ? -1 : x->name > y->name;
+}
+
+static uint32_t *ids_bucket_size;
+
+/* Largest buckets first, they are the hardest to place. */
+static int ids_cmp_bucket (const void *a, const void *b)
+{
+   const struct ids_entry *x = a, *y = b;
+
+   if (ids_bucket_size[x->bucket] != ids_bucket_size[y->bucket])
+      return ids_bucket_size[x->bucket] < ids_bucket_size[y->bucket] ? 1 : -1;
+
+   return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+/* Parse usb.ids, the vendor/product and class/subclass/protocol
+ * sections.  Interfaces and the other sections are skipped. */
+static int ids_parse (FILE *fp, struct ids_entry **list, int *num, char **pool, size_t *poolsize)
+{
+   char line[512], *name;
+   size_t len, size = 0, strsize = 4096, used = 1;
+   unsigned int id, vendor = 0, cls = 0, sub = 0;
+   enum { NONE, VENDOR, CLASS } section = NONE;
+   int count = 0, depth;
+   uint64_t key;
+
+   *list = NULL;
+   *pool = calloc (1, strsize);
+   if (!*pool)
+      return -ENOMEM;
+
+   while (fgets (line, sizeof (line), fp))
+   {
+      len = strlen (line);
+      while (len > 0 && isspace ((unsigned char)line[len - 1]))
+         line[--len] = 0;
+      if (!len || line[0] == '#')
+         continue;
+
+      for (depth = 0; line[depth] == '\t'; depth++)
+         ;
+
+      key = 0;
+      if (depth == 0)
+      {
+         if (!strncmp (line, "C ", 2) && sscanf (line + 2, "%x", &id) == 1)
+         {
+            section = CLASS;
+            cls = id;
+            key = IDS_KEY(IDS_CLASS, cls);
+            name = line + 2;
+         }
+         else if (isxdigit ((unsigned char)line[0]) && isxdigit ((unsigned char)line[1])
+                  && isxdigit ((unsigned char)line[2]) && isxdigit ((unsigned char)line[3])
+                  && line[4] == ' ' && sscanf (line, "%4x", &id) == 1)
+         {
+            section = VENDOR;
+            vendor = id;
+            key = IDS_KEY(IDS_VENDOR, vendor);
+            name = line;
+         }
+         else
+         {
+            section = NONE;
+         }
+      }
+      else if (depth == 1 && sscanf (line + 1, "%x", &id) == 1)
+      {
+         name = line + 1;
+         if (section == VENDOR)
+            key = IDS_KEY(IDS_PRODUCT, (vendor << 16) | id);
+         else if (section == CLASS)
+         {
+            sub = id;
+            key = IDS_KEY(IDS_SUBCLASS, (cls << 8) | sub);
+         }
+      }
+      else if (depth == 2 && section == CLASS && sscanf (line + 2, "%x", &id) == 1)
+      {
+         name = line + 2;
+         key = IDS_KEY(IDS_PROTOCOL, (cls << 16) | (sub << 8) | id);
+      }
+
+      if (!key)
+         continue;
+
+      /* Skip the id, the name follows after two spaces. */
+      while (*name && !isspace ((unsigned char)*name))
+         name++;
+      while (isspace ((unsigned char)*name))
+         name++;
+      len = strlen (name) + 1;
+      if (len == 1)
+         continue;
+
+      if (count == (int)size)
+      {
+         struct ids_entry *tmp;
+
+         size = size ? size * 2 : 4096;
+         tmp = realloc (*list, size * sizeof (struct ids_entry));
+         if (!tmp)
+            return -ENOMEM;
+         *list = tmp;
+      }
+      if (used + len > strsize)
+      {
+         char *tmp;
+
+         strsize = (strsize + len) * 2;
+         tmp = realloc (*pool, strsize);
+         if (!tmp)
+            return -ENOMEM;
+         *pool = tmp;
+      }
+
+      (*list)[count].key  = key;
+      (*list)[count].name = used;
+      memcpy (*pool + used, name, len);
+      used += len;
+      count++;
+   }
+
+   *num = count;
+   *poolsize = used;
+
+   return 0;
+}
+
+/* Find a displacement for each bucket so that all keys land in free,
+ * distinct slots.  Returns 0 on success, or -1 if nslots is too tight. */
+static int ids_place (struct ids_entry *list, int num, uint32_t nslots,
+                      uint32_t *disp, uint64_t *keys, uint32_t *names)
+{
+   uint32_t *slot;
+   uint32_t d, b;
+   int i, j, k, end;
+
+   slot = malloc (num * sizeof (uint32_t) + 1);
+   if (!slot)
+      return -1;
+
+   memset (keys, 0, nslots * sizeof (uint64_t));
+   for (i = 0; i < num; i = end)
+   {
+      b = list[i].bucket;
+      for (end = i; end < num && list[end].bucket == b; end++)
+         ;
+
+      for (d = 1; d < IDS_MAX_DISP; d++)
+      {
+         for (j = i; j < end; j++)
+         {
+            slot[j] = ids_hash (list[j].key, d) % nslots;
+            if (keys[slot[j]])
+               break;
+            for (k = i; k < j; k++)
+            {
+               if (slot[k] == slot[j])
+                  break;
+            }
+            if (k < j)
+               break;
+         }
+         if (j == end)
+            break;
+      }
+      if (d == IDS_MAX_DISP)
+      {
+         free (slot);
+         return -1;
+      }
+
+      disp[b] = d;
+      for (j = i; j < end; j++)
+      {
+         keys[slot[j]]  = list[j].key;
+         names[slot[j]] = list[j].name;
+      }
+   }
+
+   free (slot);
+
+   return 0;
+}
+
+/* Compile a usb.ids text file into a binary index for usb_ids_open() */
+int usb_ids_compile (const char *source, const char *index)
+{
+   struct usb_ids_header hdr;
+   struct ids_entry *list = NULL;
+   char tmp[PATH_MAX + 1];
+   char *pool = NULL, *buf = NULL;
+   size_t poolsize = 0, off;
+   int i, j, num = 0, fd, result;
+   FILE *fp;
+
+   fp = fopen (source, "r");
+   if (!fp)
+   {
+      USB_ERROR_STR(-errno, "could not open %s: %s", source, strerror(errno));
+   }
+   result = ids_parse (fp, &list, &num, &pool, &poolsize);
+   fclose (fp);
+   if (result)
+      goto exit;
+
+   /* Drop duplicate ids, first one wins. */
+   qsort (list, num, sizeof (struct ids_entry), ids_cmp_key);
+   for (i = j = 0; i < num; i++)
+   {
+      if (j && list[j - 1].key == list[i].key)
+         continue;
+      list[j++] = list[i];
+   }
+   num = j;
+
+   memset (&hdr, 0, sizeof (hdr));
+   hdr.magic    = USB_IDS_MAGIC;
+   hdr.version  = USB_IDS_VERSION;
+   hdr.count    = num;
+   hdr.nbuckets = num / 4 + 1;
+   hdr.nslots   = num + num / 4 + 1;
+   hdr.strsize  = poolsize;
+
+   ids_bucket_size = calloc (hdr.nbuckets, sizeof (uint32_t));
+   if (!ids_bucket_size)
+   {
+      result = -ENOMEM;
+      goto exit;
+   }
+   for (i = 0; i < num; i++)
+   {
+      list[i].bucket = ids_hash (list[i].key, 0) % hdr.nbuckets;
+      ids_bucket_size[list[i].bucket]++;
+   }
+   qsort (list, num, sizeof (struct ids_entry), ids_cmp_bucket);
+   free (ids_bucket_size);
+   ids_bucket_size = NULL;
+
+   while (1)
+   {
+      off = ALIGN8(sizeof (hdr));
+      hdr.disp  = off; off += ALIGN8(hdr.nbuckets * sizeof (uint32_t));
+      hdr.keys  = off; off += hdr.nslots * sizeof (uint64_t);
+      hdr.names = off; off += ALIGN8(hdr.nslots * sizeof (uint32_t));
+      hdr.str   = off;
+
+      free (buf);
+      buf = calloc (1, off);
+      if (!buf)
+      {
+         result = -ENOMEM;
+         goto exit;
+      }
+
+      if (!ids_place (list, num, hdr.nslots, (uint32_t *)(buf + hdr.disp),
+                      (uint64_t *)(buf + hdr.keys), (uint32_t *)(buf + hdr.names)))
+         break;
+
+      hdr.nslots += hdr.nslots / 8 + 1;
+   }
+   memcpy (buf, &hdr, sizeof (hdr));
+
+   /* The cache directory may not exist on a fresh system */
+   snprintf (tmp, sizeof (tmp), "%s", index);
+   if (strrchr (tmp, '/') && strrchr (tmp, '/') != tmp)
+   {
+      *strrchr (tmp, '/') = 0;
+      mkdir (tmp, 0755);
+   }
+
+   snprintf (tmp, sizeof (tmp), "%s.XXXXXX", index);
+   fd = mkstemp (tmp);
+   if (fd < 0)
+   {
+      result = -errno;
+      goto exit;
+   }
+
+   if (write (fd, buf, hdr.str) != (ssize_t)hdr.str
+       || write (fd, pool, poolsize) != (ssize_t)poolsize
+       || fchmod (fd, 0644) || close (fd))
+   {
+      result = -errno;
+      unlink (tmp);
+      goto exit;
+   }
+
+   if (rename (tmp, index))
+   {
+      result = -errno;
+      unlink (tmp);
+   }
+
+  exit:
+   free (buf);
+   free (pool);
+   free (list);
+
+   if (result)
+   {
+      USB_ERROR_STR(result, "could not compile %s: %s", index, strerror(-result));
+   }
+
+   return num;
+}
+
+/* Map the index.  A missing or broken index is not fatal, lookups then
+ * simply return NULL. */
+int usb_ids_open (const char *index)
+{
+   const struct usb_ids_header *hdr;
+   struct stat st;
+   char *map;
+   int fd;
+
+   usb_ids_close ();
+
+   fd = open (index, O_RDONLY);
+   if (fd < 0)
+   {
+      USB_ERROR_STR(-errno, "could not open %s: %s", index, strerror(errno));
+   }
+
+   if (fstat (fd, &st) || st.st_size < (off_t)sizeof (*hdr))
+   {
+      close (fd);
+      USB_ERROR_STR(-EINVAL, "%s is truncated", index);
+   }
+
+   map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close (fd);
+   if (map == MAP_FAILED)
+   {
+      USB_ERROR_STR(-errno, "could not map %s: %s", index, strerror(errno));
+   }
+
+   hdr = (const struct usb_ids_header *)map;
+   if (hdr->magic != USB_IDS_MAGIC || hdr->version != USB_IDS_VERSION
+       || !hdr->nbuckets || !hdr->nslots || !hdr->strsize
+       || hdr->disp % 8 || hdr->keys % 8 || hdr->names % 8
+       || hdr->disp + (uint64_t)hdr->nbuckets * sizeof (uint32_t) > hdr->keys
+       || hdr->keys + (uint64_t)hdr->nslots * sizeof (uint64_t) > hdr->names
+       || hdr->names + (uint64_t)hdr->nslots * sizeof (uint32_t) > hdr->str
+       || hdr->str + (uint64_t)hdr->strsize > (uint64_t)st.st_size
+       || map[hdr->str + hdr->strsize - 1])
+   {
+      munmap (map, st.st_size);
+      USB_ERROR_STR(-EINVAL, "%s is not a version %d usb.ids index", index, USB_IDS_VERSION);
+   }
+
+   ids.map   = map;
+   ids.size  = st.st_size;
+   ids.hdr   = hdr;
+   ids.disp  = (const uint32_t *)(map + hdr->disp);
+   ids.keys  = (const uint64_t *)(map + hdr->keys);
+   ids.names = (const uint32_t *)(map + hdr->names);
+   ids.str   = map + hdr->str;
+
+   return 0;
+}
+
+void usb_ids_close (void)
+{
+   if (ids.map)
+      munmap (ids.map, ids.size);
+   memset (&ids, 0, sizeof (ids));
+}
+
+static const char *ids_lookup (uint64_t key)
+{
+   uint32_t d, slot;
+
+   if (!ids.map)
+      return NULL;
+
+   d    = ids.disp[ids_hash (key, 0) % ids.hdr->nbuckets];
+   slot = ids_hash (key, d) % ids.hdr->nslots;
+   if (ids.keys[slot] != key || ids.names[slot] >= ids.hdr->strsize)
+      return NULL;
+
+   return ids.str + ids.names[slot];
+}
+
+const char *usb_ids_vendor (uint16_t vid)
+{
+   return ids_lookup (IDS_KEY(IDS_VENDOR, vid));
+}
+
+const char *usb_ids_product (uint16_t vid, uint16_t pid)
+{
+   return ids_lookup (IDS_KEY(IDS_PRODUCT, ((uint32_t)vid << 16) | pid));
+}
+
+const char *usb_ids_class (uint8_t cls)
+{
+   return ids_lookup (IDS_KEY(IDS_CLASS, cls));
+}
+
+const char *usb_ids_subclass (uint8_t cls, uint8_t sub)
+{
+   return ids_lookup (IDS_KEY(IDS_SUBCLASS, (cls << 8) | sub));
+}
+
+const char *usb_ids_protocol (uint8_t cls, uint8_t sub, uint8_t proto)
+{
+   return ids_lookup (IDS_KEY(IDS_PROTOCOL, (cls << 16) | (sub << 8) | proto));
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,63 @@
+/* usbids.h  --  Constant time name lookup from a compiled usb.ids.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBIDS_H
+#define _USBIDS_H
+
+#include <stdint.h>
+
+#define USB_IDS_SOURCE   "/usr/share/hwdata/usb.ids"
+#define USB_IDS_INDEX    "/var/cache/usbctl/usb.ids.idx"
+
+#define USB_IDS_MAGIC    0x44494255    /* "UBID" */
+#define USB_IDS_VERSION  1
+
+/* On-disk layout, host byte order.  Keys are placed with a hash and
+ * displace perfect hash: the bucket hash picks a displacement seed, and
+ * the seeded hash gives the one slot the key can be in. */
+struct usb_ids_header
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t count;
+   uint32_t nbuckets;
+   uint32_t nslots;
+   uint32_t strsize;
+
+   /* Byte offsets from start of file */
+   uint32_t disp;               /* uint32_t[nbuckets] */
+   uint32_t keys;               /* uint64_t[nslots], 0 is unused */
+   uint32_t names;              /* uint32_t[nslots] string offsets */
+   uint32_t str;                /* char[strsize] */
+};
+
+#define usb_ids_label(name) ((name) ? (name) : "")
+
+int usb_ids_compile (const char *source, const char *index);
+int usb_ids_open (const char *index);
+void usb_ids_close (void);
+
+const char *usb_ids_vendor (uint16_t vid);
+const char *usb_ids_product (uint16_t vid, uint16_t pid);
+const char *usb_ids_class (uint8_t cls);
+const char *usb_ids_subclass (uint8_t cls, uint8_t sub);
+const char *usb_ids_protocol (uint8_t cls, uint8_t sub, uint8_t proto);
+
+#endif /* _USBIDS_H */
@@ -0,0 +1,238 @@
+/* usblock.c  --  Per-device advisory locks with FIFO queueing.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "error.h"
+#include "usblock.h"
+#include "usbstat.h"
+#include "usbsysfs.h"
+
+extern int usb_debug;
+
+int usb_lock_timeout = USB_LOCK_TIMEOUT;
+
+static pthread_mutex_t  stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct usb_stat  stat_wait;
+static int              stat_timeouts;
+
+/* Enter the critical section and read the queue state. */
+static int lock_begin (int fd, struct usb_lock_file *lf)
+{
+   if (flock (fd, LOCK_EX))
+      return -errno;
+
+   if (pread (fd, lf, sizeof (*lf), 0) != sizeof (*lf))
+      memset (lf, 0, sizeof (*lf));
+
+   return 0;
+}
+
+static int lock_end (int fd, struct usb_lock_file *lf)
+{
+   int result = 0;
+
+   if (pwrite (fd, lf, sizeof (*lf), 0) != sizeof (*lf))
+      result = -errno;
+   flock (fd, LOCK_UN);
+
+   return result;
+}
+
+/* Move serving past tickets whose owner gave up or died */
+static void lock_reap (struct usb_lock_file *lf)
+{
+   pid_t pid;
+
+   while (lf->serving != lf->next)
+   {
+      pid = lf->slot[lf->serving % USB_LOCK_SLOTS];
+      if (pid && (kill (pid, 0) == 0 || errno != ESRCH))
+         break;
+
+      lf->slot[lf->serving % USB_LOCK_SLOTS] = 0;
+      lf->serving++;
+   }
+}
+
+static void lock_account (double waited, int timeout)
+{
+   pthread_mutex_lock (&stat_lock);
+   usb_stat_add (&stat_wait, waited);
+   if (timeout)
+      stat_timeouts++;
+   pthread_mutex_unlock (&stat_lock);
+}
+
+/* The port dev hangs off, e.g. 1-1.2, stays the same when the device
+ * re-enumerates with a new address.  Bus and device number are only
+ * used when sysfs does not know the device. */
+static void lock_name (struct usb_device *dev, char *name, size_t len)
+{
+   char path[PATH_MAX + 1], *p;
+
+   if (!usb_sysfs_path (dev, path, sizeof (path)))
+   {
+      p = strrchr (path, '/') + 1;
+      if (strlen (p) < len)
+      {
+         strcpy (name, p);
+         return;
+      }
+   }
+
+   snprintf (name, len, "%03d-%03d", atoi (dev->bus->dirname), dev->devnum);
+}
+
+/* Queue for dev and wait, at most timeout ms, for our turn.  The lock
+ * is advisory, if the lock directory is unusable nothing is locked. */
+int usb_lock_acquire (struct usb_device *dev, int timeout, struct usb_lock *lock)
+{
+   struct usb_lock_file lf;
+   struct timespec start;
+   char name[32], file[sizeof (USB_LOCK_DIR) + sizeof (name)];
+   uint32_t ahead;
+   int result;
+
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   lock->waited = 0;
+
+   mkdir (USB_LOCK_DIR, 01777);
+   lock_name (dev, name, sizeof (name));
+   snprintf (file, sizeof (file), "%s/%s", USB_LOCK_DIR, name);
+   lock->fd = open (file, O_RDWR | O_CREAT, 0666);
+   if (lock->fd < 0)
+      return 0;
+   fchmod (lock->fd, 0666);   /* shared with other users, despite umask */
+
+   result = lock_begin (lock->fd, &lf);
+   if (result)
+      goto fail;
+
+   lock_reap (&lf);
+   if (lf.next - lf.serving >= USB_LOCK_SLOTS)
+   {
+      lock_end (lock->fd, &lf);
+      result = -EBUSY;
+      goto fail;
+   }
+   lock->ticket = lf.next++;
+   lf.slot[lock->ticket % USB_LOCK_SLOTS] = getpid ();
+   result = lock_end (lock->fd, &lf);
+   if (result)
+      goto fail;
+
+   while (1)
+   {
+      result = lock_begin (lock->fd, &lf);
+      if (result)
+         goto fail;
+
+      lock_reap (&lf);
+      if (lf.serving == lock->ticket)
+      {
+         lock_end (lock->fd, &lf);
+         break;
+      }
+
+      ahead = lock->ticket - lf.serving;
+      if (timeout >= 0 && usb_elapsed_ms (&start) >= timeout)
+      {
+         /* Leave the queue, whoever gets to our ticket skips it */
+         lf.slot[lock->ticket % USB_LOCK_SLOTS] = 0;
+         lock_end (lock->fd, &lf);
+         close (lock->fd);
+         lock->fd = -1;
+
+         lock->waited = usb_elapsed_ms (&start);
+         lock_account (lock->waited, 1);
+         USB_ERROR_STR(-ETIMEDOUT, "timed out after %.0f ms waiting for %s, %u ahead in queue",
+                       lock->waited, name, ahead);
+      }
+
+      lock_end (lock->fd, &lf);
+      usleep (USB_LOCK_POLL * 1000);
+   }
+
+   lock->waited = usb_elapsed_ms (&start);
+   lock_account (lock->waited, 0);
+
+   return 0;
+
+  fail:
+   close (lock->fd);
+   lock->fd = -1;
+   USB_ERROR_STR(result, "could not lock %s: %s", file, strerror(-result));
+}
+
+int usb_lock_release (struct usb_lock *lock)
+{
+   struct usb_lock_file lf;
+   int result;
+
+   if (lock->fd < 0)
+      return 0;
+
+   result = lock_begin (lock->fd, &lf);
+   if (!result)
+   {
+      lf.slot[lock->ticket % USB_LOCK_SLOTS] = 0;
+      if (lf.serving == lock->ticket)
+         lf.serving++;
+      lock_reap (&lf);
+      result = lock_end (lock->fd, &lf);
+   }
+
+   close (lock->fd);
+   lock->fd = -1;
+
+   return result;
+}
+
+void usb_lock_report (FILE *fp)
+{
+   pthread_mutex_lock (&stat_lock);
+   if (stat_wait.num)
+   {
+      fprintf (fp, "lock: %d claims, %d timed out, wait: ", stat_wait.num, stat_timeouts);
+      usb_stat_print (fp, &stat_wait, "ms");
+      fprintf (fp, "\n");
+   }
+   pthread_mutex_unlock (&stat_lock);
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
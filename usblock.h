@@ -0,0 +1,59 @@
+/* usblock.h  --  Per-device advisory locks with FIFO queueing.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBLOCK_H
+#define _USBLOCK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <usb.h>
+
+#define USB_LOCK_DIR     "/var/lock/usbctl"
+#define USB_LOCK_SLOTS   64
+#define USB_LOCK_TIMEOUT 10000         /* ms */
+#define USB_LOCK_POLL    10            /* ms */
+
+/* On disk, one file per device, named after the hub port it is
+ * attached to.  Each claimer draws a ticket from next and waits until
+ * serving reaches it.  A slot holds the pid of each ticket still in
+ * the queue, dead or abandoned tickets are skipped. */
+struct usb_lock_file
+{
+   uint32_t next;
+   uint32_t serving;
+   pid_t    slot[USB_LOCK_SLOTS];
+};
+
+struct usb_lock
+{
+   int      fd;
+   uint32_t ticket;
+   double   waited;                    /* ms */
+};
+
+/* How long usb_claim_device() waits, 0 fails at once, <0 waits forever */
+extern int usb_lock_timeout;
+
+int  usb_lock_acquire (struct usb_device *dev, int timeout, struct usb_lock *lock);
+int  usb_lock_release (struct usb_lock *lock);
+void usb_lock_report (FILE *fp);
+
+#endif /* _USBLOCK_H */
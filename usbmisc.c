@@ -18,8 +18,13 @@
  *
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -129,3 +134,273 @@ struct usb_device *get_usb_device(const char *path)
         }
         return NULL;
 }
+
+/* A device read directly from its node, owns its bus and raw descriptors */
+struct usb_device_direct {
+        struct usb_device dev;
+        struct usb_bus bus;
+        int size;
+        unsigned char raw[0];
+};
+
+#define USB_DIRECT_MAX 65536
+
+static uint16_t le16(const unsigned char *p)
+{
+        return p[0] | (p[1] << 8);
+}
+
+static uint16_t h16(const unsigned char *p)
+{
+        uint16_t v;
+
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+/* Parse one configuration, like libusb does.  Unknown descriptors are
+ * left in the raw buffer and referenced as extra by the preceding
+ * config, interface or endpoint. */
+static int parse_configuration(struct usb_config_descriptor *config, unsigned char *buf, int size)
+{
+        struct usb_interface *intf;
+        struct usb_interface_descriptor *alt = NULL;
+        struct usb_endpoint_descriptor *ep;
+        unsigned char *p, *end, **extra;
+        int *extralen;
+        int i, len, num_if = 0, num_ep = 0;
+
+        if (size < 9 || buf[1] != USB_DT_CONFIG)
+                return -1;
+
+        config->bLength = buf[0];
+        config->bDescriptorType = buf[1];
+        config->wTotalLength = le16(buf + 2);
+        config->bNumInterfaces = buf[4];
+        config->bConfigurationValue = buf[5];
+        config->iConfiguration = buf[6];
+        config->bmAttributes = buf[7];
+        config->MaxPower = buf[8];
+
+        config->interface = calloc(config->bNumInterfaces + 1, sizeof(struct usb_interface));
+        if (!config->interface)
+                return -1;
+
+        extra = &config->extra;
+        extralen = &config->extralen;
+        end = buf + (config->wTotalLength < size ? config->wTotalLength : size);
+        for (p = buf + buf[0]; p + 2 <= end; p += len) {
+                len = p[0];
+                if (len < 2 || p + len > end)
+                        break;
+
+                if (p[1] == USB_DT_INTERFACE && len >= 9) {
+                        for (i = 0; i < num_if; i++)
+                                if (config->interface[i].altsetting[0].bInterfaceNumber == p[2])
+                                        break;
+                        if (i == num_if) {
+                                if (num_if == config->bNumInterfaces)
+                                        break;
+                                num_if++;
+                        }
+
+                        intf = &config->interface[i];
+                        alt = realloc(intf->altsetting, (intf->num_altsetting + 1) * sizeof(*alt));
+                        if (!alt)
+                                return -1;
+                        intf->altsetting = alt;
+                        alt = &intf->altsetting[intf->num_altsetting++];
+                        memset(alt, 0, sizeof(*alt));
+
+                        alt->bLength = p[0];
+                        alt->bDescriptorType = p[1];
+                        alt->bInterfaceNumber = p[2];
+                        alt->bAlternateSetting = p[3];
+                        alt->bNumEndpoints = p[4];
+                        alt->bInterfaceClass = p[5];
+                        alt->bInterfaceSubClass = p[6];
+                        alt->bInterfaceProtocol = p[7];
+                        alt->iInterface = p[8];
+                        alt->endpoint = calloc(alt->bNumEndpoints + 1, sizeof(*ep));
+                        if (!alt->endpoint)
+                                return -1;
+
+                        num_ep = 0;
+                        extra = &alt->extra;
+                        extralen = &alt->extralen;
+                }
+                else if (p[1] == USB_DT_ENDPOINT && len >= 7 && alt && num_ep < alt->bNumEndpoints) {
+                        ep = &alt->endpoint[num_ep++];
+                        ep->bLength = p[0];
+                        ep->bDescriptorType = p[1];
+                        ep->bEndpointAddress = p[2];
+                        ep->bmAttributes = p[3];
+                        ep->wMaxPacketSize = le16(p + 4);
+                        ep->bInterval = p[6];
+                        if (len >= 9) {
+                                ep->bRefresh = p[7];
+                                ep->bSynchAddress = p[8];
+                        }
+
+                        extra = &ep->extra;
+                        extralen = &ep->extralen;
+                }
+                else {
+                        if (!*extra)
+                                *extra = p;
+                        *extralen += len;
+                }
+        }
+        config->bNumInterfaces = num_if;
+
+        return 0;
+}
+
+/* Read raw descriptors, the usbfs node and sysfs "descriptors" file
+ * both give the device descriptor followed by all configurations. */
+static int read_descriptors(const char *file, unsigned char *buf, int size)
+{
+        int fd, len = 0, ret;
+
+        fd = open(file, O_RDONLY);
+        if (fd < 0)
+                return -1;
+
+        while (len < size && (ret = read(fd, buf + len, size - len)) > 0)
+                len += ret;
+        close(fd);
+
+        return len;
+}
+
+/* Build a usb_device for a single device node, /proc/bus/usb/BBB/DDD,
+ * /dev/bus/usb/BBB/DDD, or its sysfs directory, without scanning any
+ * bus.  The result is usable with usb_open() and must be released with
+ * free_usb_device(). */
+struct usb_device *get_usb_device_direct(const char *path)
+{
+        struct usb_device_direct *direct;
+        struct usb_device *dev;
+        char file[PATH_MAX + 1];
+        char device_path[PATH_MAX + 1];
+        char absolute_path[PATH_MAX + 1];
+        unsigned char *buf;
+        int busnum, devnum, len, i, host = 0;
+        char *p;
+        FILE *fp;
+
+        buf = malloc(USB_DIRECT_MAX);
+        if (!buf)
+                return NULL;
+
+        snprintf(file, sizeof(file), "%s/busnum", path);
+        fp = fopen(file, "r");
+        if (fp) {
+                /* sysfs device directory */
+                i = fscanf(fp, "%d", &busnum);
+                fclose(fp);
+                snprintf(file, sizeof(file), "%s/devnum", path);
+                fp = fopen(file, "r");
+                if (i != 1 || !fp || fscanf(fp, "%d", &devnum) != 1) {
+                        if (fp)
+                                fclose(fp);
+                        goto error;
+                }
+                fclose(fp);
+                snprintf(file, sizeof(file), "%s/descriptors", path);
+        }
+        else {
+                /* usbfs node, the last two components are bus and device */
+                readlink_recursive(path, device_path, sizeof(device_path));
+                get_absolute_path(device_path, absolute_path, sizeof(absolute_path));
+                p = strrchr(absolute_path, '/');
+                if (!p || p == absolute_path)
+                        goto error;
+                devnum = atoi(p + 1);
+                while (--p > absolute_path && *p != '/')
+                        ;
+                busnum = atoi(p + 1);
+                strncpy(file, absolute_path, sizeof(file));
+                /* usbfs hands out the device descriptor the kernel
+                 * already converted to host order, the configurations
+                 * after it are raw */
+                host = 1;
+        }
+
+        len = read_descriptors(file, buf, USB_DIRECT_MAX);
+        if (len < USB_DT_DEVICE_SIZE || buf[1] != USB_DT_DEVICE || busnum <= 0 || devnum <= 0)
+                goto error;
+
+        direct = calloc(1, sizeof(*direct) + len);
+        if (!direct)
+                goto error;
+        memcpy(direct->raw, buf, len);
+        direct->size = len;
+        free(buf);
+        buf = direct->raw;
+
+        dev = &direct->dev;
+        dev->bus = &direct->bus;
+        direct->bus.devices = dev;
+        snprintf(direct->bus.dirname, sizeof(direct->bus.dirname), "%03d", busnum);
+        snprintf(dev->filename, sizeof(dev->filename), "%03d", devnum);
+        dev->devnum = devnum;
+
+        dev->descriptor.bLength = buf[0];
+        dev->descriptor.bDescriptorType = buf[1];
+        dev->descriptor.bcdUSB = host ? h16(buf + 2) : le16(buf + 2);
+        dev->descriptor.bDeviceClass = buf[4];
+        dev->descriptor.bDeviceSubClass = buf[5];
+        dev->descriptor.bDeviceProtocol = buf[6];
+        dev->descriptor.bMaxPacketSize0 = buf[7];
+        dev->descriptor.idVendor = host ? h16(buf + 8) : le16(buf + 8);
+        dev->descriptor.idProduct = host ? h16(buf + 10) : le16(buf + 10);
+        dev->descriptor.bcdDevice = host ? h16(buf + 12) : le16(buf + 12);
+        dev->descriptor.iManufacturer = buf[14];
+        dev->descriptor.iProduct = buf[15];
+        dev->descriptor.iSerialNumber = buf[16];
+        dev->descriptor.bNumConfigurations = buf[17];
+
+        dev->config = calloc(dev->descriptor.bNumConfigurations + 1, sizeof(struct usb_config_descriptor));
+        if (!dev->config) {
+                free_usb_device(dev);
+                return NULL;
+        }
+
+        for (i = 0, len = buf[0]; i < dev->descriptor.bNumConfigurations; i++) {
+                if (parse_configuration(&dev->config[i], buf + len, direct->size - len)) {
+                        free_usb_device(dev);
+                        return NULL;
+                }
+                len += dev->config[i].wTotalLength;
+        }
+
+        return dev;
+
+error:
+        free(buf);
+        return NULL;
+}
+
+void free_usb_device(struct usb_device *dev)
+{
+        struct usb_interface *intf;
+        int c, i, a;
+
+        if (!dev)
+                return;
+
+        for (c = 0; dev->config && c < dev->descriptor.bNumConfigurations; c++) {
+                for (i = 0; i < dev->config[c].bNumInterfaces; i++) {
+                        intf = &dev->config[c].interface[i];
+                        for (a = 0; a < intf->num_altsetting; a++)
+                                free(intf->altsetting[a].endpoint);
+                        free(intf->altsetting);
+                }
+                free(dev->config[c].interface);
+        }
+        free(dev->config);
+
+        /* dev is the first member of struct usb_device_direct */
+        free(dev);
+}
@@ -26,5 +26,7 @@
 #define PATH_USBFS "/proc/bus/usb"
 
 extern struct usb_device *get_usb_device(const char *path);
+extern struct usb_device *get_usb_device_direct(const char *path);
+extern void free_usb_device(struct usb_device *dev);
 
 #endif /* _USBMISC_H */
@@ -0,0 +1,105 @@
+/* usbpool.c  --  Small worker pool for per-device jobs.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "usbpool.h"
+
+struct usb_pool
+{
+   pthread_mutex_t lock;
+   int next, count;
+
+   usb_pool_fn fn;
+   void *arg;
+};
+
+static void *usb_pool_worker (void *arg)
+{
+   struct usb_pool *pool = arg;
+   int index;
+
+   while (1)
+   {
+      pthread_mutex_lock (&pool->lock);
+      index = pool->next++;
+      pthread_mutex_unlock (&pool->lock);
+
+      if (index >= pool->count)
+         break;
+
+      pool->fn (index, pool->arg);
+   }
+
+   return NULL;
+}
+
+/* Call fn(index, arg) for index 0..count-1 using at most jobs threads.
+ * Jobs are handed out in order, but may complete in any order, so the
+ * caller must keep per-index results and collect them afterwards. */
+int usb_pool_run (int jobs, int count, usb_pool_fn fn, void *arg)
+{
+   struct usb_pool pool;
+   pthread_t *tid;
+   int i, num = 0;
+
+   if (jobs > count)
+      jobs = count;
+
+   pool.next  = 0;
+   pool.count = count;
+   pool.fn    = fn;
+   pool.arg   = arg;
+   pthread_mutex_init (&pool.lock, NULL);
+
+   tid = calloc (jobs > 0 ? jobs : 1, sizeof (pthread_t));
+   if (tid)
+   {
+      for (num = 0; num < jobs; num++)
+      {
+         if (pthread_create (&tid[num], NULL, usb_pool_worker, &pool))
+            break;
+      }
+   }
+
+   /* No threads at all, do the work here instead. */
+   if (!num)
+      usb_pool_worker (&pool);
+
+   for (i = 0; i < num; i++)
+      pthread_join (tid[i], NULL);
+
+   free (tid);
+   pthread_mutex_destroy (&pool.lock);
+
+   return 0;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
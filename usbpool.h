@@ -0,0 +1,28 @@
+/* usbpool.h  --  Small worker pool for per-device jobs.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBPOOL_H
+#define _USBPOOL_H
+
+typedef void (*usb_pool_fn) (int index, void *arg);
+
+int usb_pool_run (int jobs, int count, usb_pool_fn fn, void *arg);
+
+#endif /* _USBPOOL_H */
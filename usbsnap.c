@@ -0,0 +1,408 @@
+/* usbsnap.c  --  Compact, mmap'able snapshot of a device list.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "error.h"
+#include "usbext.h"
+#include "usbpool.h"
+#include "usbsnap.h"
+
+#define ALIGN8(x) (((x) + 7) & ~7)
+
+/* Strings collected from each device before the pool is built. */
+struct snap_entry
+{
+   struct usb_device *dev;
+   char manufacturer[128];
+   char product[128];
+   char serial[128];
+   char driver[64];
+};
+
+/* String pool with duplicate elimination, only used while writing. */
+struct snap_pool
+{
+   char     *buf;
+   size_t    len, size;
+   uint32_t *hash;
+   size_t    slots;
+};
+
+static void snap_fetch (int i, void *arg)
+{
+   struct snap_entry *entry = (struct snap_entry *)arg + i;
+   struct usb_device *dev = entry->dev;
+   struct usb_dev_handle *udev;
+
+   udev = usb_open (dev);
+   if (!udev)
+      return;
+
+   if (dev->descriptor.iManufacturer)
+      usb_get_string_simple (udev, dev->descriptor.iManufacturer,
+                             entry->manufacturer, sizeof (entry->manufacturer));
+   if (dev->descriptor.iProduct)
+      usb_get_string_simple (udev, dev->descriptor.iProduct,
+                             entry->product, sizeof (entry->product));
+   if (dev->descriptor.iSerialNumber)
+      usb_get_string_simple (udev, dev->descriptor.iSerialNumber,
+                             entry->serial, sizeof (entry->serial));
+#ifdef LIBUSB_HAS_GET_DRIVER_NP
+   if (dev->config
+       && usb_get_driver_np (udev, INTERFACE_NUMBER(dev), entry->driver,
+                             sizeof (entry->driver)))
+      entry->driver[0] = 0;
+#endif
+
+   usb_close (udev);
+}
+
+static uint32_t snap_hash (const char *str)
+{
+   uint32_t hash = 2166136261u;
+
+   while (*str)
+      hash = (hash ^ (unsigned char)*str++) * 16777619u;
+
+   return hash;
+}
+
+/* Intern str, its offset goes to *off, 0 for the empty string */
+static int snap_pool_add (struct snap_pool *pool, const char *str, uint32_t *off)
+{
+   size_t len = strlen (str) + 1;
+   size_t slot;
+
+   *off = 0;
+   if (!*str)
+      return 0;
+
+   slot = snap_hash (str) % pool->slots;
+   while ((*off = pool->hash[slot]))
+   {
+      if (!strcmp (pool->buf + *off, str))
+         return 0;
+      slot = (slot + 1) % pool->slots;
+   }
+
+   if (pool->len + len > pool->size)
+   {
+      size_t size = (pool->size + len) * 2;
+      char *buf;
+
+      buf = realloc (pool->buf, size);
+      if (!buf)
+         return -ENOMEM;
+      pool->buf  = buf;
+      pool->size = size;
+   }
+
+   *off = pool->len;
+   memcpy (pool->buf + *off, str, len);
+   pool->len += len;
+   pool->hash[slot] = *off;
+
+   return 0;
+}
+
+/* A short write is as bad as a failed one */
+static int snap_write (int fd, const void *buf, size_t len)
+{
+   ssize_t num;
+
+   num = write (fd, buf, len);
+   if (num < 0)
+      return -errno;
+
+   return num == (ssize_t)len ? 0 : -EIO;
+}
+
+/* Write a snapshot of list to file.  The file is replaced atomically so
+ * readers that already have the old one mapped are not disturbed. */
+int usb_snap_write (const char *file, struct usb_device *list, int jobs)
+{
+   struct usb_snap_header hdr;
+   struct snap_entry *entry;
+   struct snap_pool pool;
+   struct usb_device *dev;
+   char tmp[PATH_MAX + 1];
+   uint32_t *bus, *name, *manuf, *prod, *serial, *driver;
+   uint16_t *vid, *pid, *bcd, *bcdusb;
+   uint8_t *devclass, *devnum;
+   char *buf = NULL;
+   size_t off;
+   int i, num = 0, fd, result = 0;
+
+   for (dev = list; dev; dev = dev->next)
+      num++;
+
+   entry = calloc (num ? num : 1, sizeof (struct snap_entry));
+   pool.slots = num * 8 + 16;
+   pool.hash  = calloc (pool.slots, sizeof (uint32_t));
+   pool.size  = 4096;
+   pool.len   = 1;
+   pool.buf   = calloc (1, pool.size);
+   if (!entry || !pool.hash || !pool.buf)
+   {
+      result = -ENOMEM;
+      goto exit;
+   }
+
+   for (i = 0, dev = list; dev; dev = dev->next)
+      entry[i++].dev = dev;
+   usb_pool_run (jobs, num, snap_fetch, entry);
+
+   memset (&hdr, 0, sizeof (hdr));
+   hdr.magic   = USB_SNAP_MAGIC;
+   hdr.version = USB_SNAP_VERSION;
+   hdr.count   = num;
+
+   off = ALIGN8(sizeof (hdr));
+   hdr.vid          = off; off += ALIGN8(num * sizeof (uint16_t));
+   hdr.pid          = off; off += ALIGN8(num * sizeof (uint16_t));
+   hdr.bcd          = off; off += ALIGN8(num * sizeof (uint16_t));
+   hdr.bcdusb       = off; off += ALIGN8(num * sizeof (uint16_t));
+   hdr.devclass     = off; off += ALIGN8(num * sizeof (uint8_t));
+   hdr.devnum       = off; off += ALIGN8(num * sizeof (uint8_t));
+   hdr.busname      = off; off += ALIGN8(num * sizeof (uint32_t));
+   hdr.filename     = off; off += ALIGN8(num * sizeof (uint32_t));
+   hdr.manufacturer = off; off += ALIGN8(num * sizeof (uint32_t));
+   hdr.product      = off; off += ALIGN8(num * sizeof (uint32_t));
+   hdr.serial       = off; off += ALIGN8(num * sizeof (uint32_t));
+   hdr.driver       = off; off += ALIGN8(num * sizeof (uint32_t));
+   hdr.str          = off;
+
+   buf = calloc (1, off);
+   if (!buf)
+   {
+      result = -ENOMEM;
+      goto exit;
+   }
+
+   vid      = (uint16_t *)(buf + hdr.vid);
+   pid      = (uint16_t *)(buf + hdr.pid);
+   bcd      = (uint16_t *)(buf + hdr.bcd);
+   bcdusb   = (uint16_t *)(buf + hdr.bcdusb);
+   devclass = (uint8_t *)(buf + hdr.devclass);
+   devnum   = (uint8_t *)(buf + hdr.devnum);
+   bus      = (uint32_t *)(buf + hdr.busname);
+   name     = (uint32_t *)(buf + hdr.filename);
+   manuf    = (uint32_t *)(buf + hdr.manufacturer);
+   prod     = (uint32_t *)(buf + hdr.product);
+   serial   = (uint32_t *)(buf + hdr.serial);
+   driver   = (uint32_t *)(buf + hdr.driver);
+
+   for (i = 0; i < num; i++)
+   {
+      dev = entry[i].dev;
+
+      vid[i]      = dev->descriptor.idVendor;
+      pid[i]      = dev->descriptor.idProduct;
+      bcd[i]      = dev->descriptor.bcdDevice;
+      bcdusb[i]   = dev->descriptor.bcdUSB;
+      devclass[i] = dev->descriptor.bDeviceClass;
+      devnum[i]   = dev->devnum;
+      if (snap_pool_add (&pool, dev->bus->dirname, &bus[i])
+          || snap_pool_add (&pool, dev->filename, &name[i])
+          || snap_pool_add (&pool, entry[i].manufacturer, &manuf[i])
+          || snap_pool_add (&pool, entry[i].product, &prod[i])
+          || snap_pool_add (&pool, entry[i].serial, &serial[i])
+          || snap_pool_add (&pool, entry[i].driver, &driver[i]))
+      {
+         result = -ENOMEM;
+         goto exit;
+      }
+   }
+   hdr.strsize = pool.len;
+   memcpy (buf, &hdr, sizeof (hdr));
+
+   snprintf (tmp, sizeof (tmp), "%s.XXXXXX", file);
+   fd = mkstemp (tmp);
+   if (fd < 0)
+   {
+      result = -errno;
+      goto exit;
+   }
+
+   result = snap_write (fd, buf, hdr.str);
+   if (!result)
+      result = snap_write (fd, pool.buf, pool.len);
+   if (!result && fchmod (fd, 0644))
+      result = -errno;
+   if (close (fd) && !result)
+      result = -errno;
+   if (result)
+   {
+      unlink (tmp);
+      goto exit;
+   }
+
+   if (rename (tmp, file))
+   {
+      result = -errno;
+      unlink (tmp);
+   }
+
+  exit:
+   free (buf);
+   free (pool.buf);
+   free (pool.hash);
+   free (entry);
+
+   if (result)
+   {
+      USB_ERROR_STR(result, "could not write snapshot %s: %s", file, strerror(-result));
+   }
+
+   return 0;
+}
+
+static int snap_check_array (struct usb_snap_header *hdr, uint32_t off, size_t size)
+{
+   return off < sizeof (*hdr) || off % 8 || off + (uint64_t)hdr->count * size > hdr->str;
+}
+
+static int snap_check_str (const struct usb_snap *snap, const uint32_t *arr, uint32_t strsize)
+{
+   int i;
+
+   for (i = 0; i < snap->count; i++)
+   {
+      if (arr[i] >= strsize)
+         return 1;
+   }
+
+   return 0;
+}
+
+/* Map a snapshot read-only and validate it once, so that lookups on the
+ * view need no further bounds checking. */
+int usb_snap_open (const char *file, struct usb_snap *snap)
+{
+   struct usb_snap_header *hdr;
+   struct stat st;
+   char *map;
+   int fd;
+
+   memset (snap, 0, sizeof (*snap));
+
+   fd = open (file, O_RDONLY);
+   if (fd < 0)
+   {
+      USB_ERROR_STR(-errno, "could not open snapshot %s: %s", file, strerror(errno));
+   }
+
+   if (fstat (fd, &st) || st.st_size < (off_t)sizeof (*hdr))
+   {
+      close (fd);
+      USB_ERROR_STR(-EINVAL, "snapshot %s is truncated", file);
+   }
+
+   map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close (fd);
+   if (map == MAP_FAILED)
+   {
+      USB_ERROR_STR(-errno, "could not map snapshot %s: %s", file, strerror(errno));
+   }
+
+   snap->map  = map;
+   snap->size = st.st_size;
+
+   hdr = (struct usb_snap_header *)map;
+   if (hdr->magic != USB_SNAP_MAGIC || hdr->version != USB_SNAP_VERSION)
+   {
+      usb_snap_close (snap);
+      USB_ERROR_STR(-EINVAL, "%s is not a version %d snapshot", file, USB_SNAP_VERSION);
+   }
+
+   if (hdr->str > snap->size || hdr->strsize == 0
+       || hdr->str + (uint64_t)hdr->strsize > snap->size
+       || map[hdr->str] || map[hdr->str + hdr->strsize - 1]
+       || snap_check_array (hdr, hdr->vid, sizeof (uint16_t))
+       || snap_check_array (hdr, hdr->pid, sizeof (uint16_t))
+       || snap_check_array (hdr, hdr->bcd, sizeof (uint16_t))
+       || snap_check_array (hdr, hdr->bcdusb, sizeof (uint16_t))
+       || snap_check_array (hdr, hdr->devclass, sizeof (uint8_t))
+       || snap_check_array (hdr, hdr->devnum, sizeof (uint8_t))
+       || snap_check_array (hdr, hdr->busname, sizeof (uint32_t))
+       || snap_check_array (hdr, hdr->filename, sizeof (uint32_t))
+       || snap_check_array (hdr, hdr->manufacturer, sizeof (uint32_t))
+       || snap_check_array (hdr, hdr->product, sizeof (uint32_t))
+       || snap_check_array (hdr, hdr->serial, sizeof (uint32_t))
+       || snap_check_array (hdr, hdr->driver, sizeof (uint32_t)))
+   {
+      usb_snap_close (snap);
+      USB_ERROR_STR(-EINVAL, "snapshot %s is corrupt", file);
+   }
+
+   snap->count        = hdr->count;
+   snap->vid          = (const uint16_t *)(map + hdr->vid);
+   snap->pid          = (const uint16_t *)(map + hdr->pid);
+   snap->bcd          = (const uint16_t *)(map + hdr->bcd);
+   snap->bcdusb       = (const uint16_t *)(map + hdr->bcdusb);
+   snap->devclass     = (const uint8_t *)(map + hdr->devclass);
+   snap->devnum       = (const uint8_t *)(map + hdr->devnum);
+   snap->busname      = (const uint32_t *)(map + hdr->busname);
+   snap->filename     = (const uint32_t *)(map + hdr->filename);
+   snap->manufacturer = (const uint32_t *)(map + hdr->manufacturer);
+   snap->product      = (const uint32_t *)(map + hdr->product);
+   snap->serial       = (const uint32_t *)(map + hdr->serial);
+   snap->driver       = (const uint32_t *)(map + hdr->driver);
+   snap->str          = map + hdr->str;
+
+   if (snap_check_str (snap, snap->busname, hdr->strsize)
+       || snap_check_str (snap, snap->filename, hdr->strsize)
+       || snap_check_str (snap, snap->manufacturer, hdr->strsize)
+       || snap_check_str (snap, snap->product, hdr->strsize)
+       || snap_check_str (snap, snap->serial, hdr->strsize)
+       || snap_check_str (snap, snap->driver, hdr->strsize))
+   {
+      usb_snap_close (snap);
+      USB_ERROR_STR(-EINVAL, "snapshot %s is corrupt", file);
+   }
+
+   return 0;
+}
+
+void usb_snap_close (struct usb_snap *snap)
+{
+   if (snap->map)
+      munmap (snap->map, snap->size);
+   memset (snap, 0, sizeof (*snap));
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,71 @@
+/* usbsnap.h  --  Compact, mmap'able snapshot of a device list.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBSNAP_H
+#define _USBSNAP_H
+
+#include <stdint.h>
+#include <usb.h>
+
+#define USB_SNAP_MAGIC    0x50534255    /* "UBSP" */
+#define USB_SNAP_VERSION  1
+
+/* On-disk layout, host byte order.  The header is followed by one array
+ * per field, each count entries long and 8 byte aligned, and finally by
+ * the string pool.  String fields are offsets into the pool, where
+ * offset 0 is always the empty string. */
+struct usb_snap_header
+{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t count;
+   uint32_t strsize;
+
+   /* Byte offsets from start of file */
+   uint32_t vid, pid, bcd, bcdusb;      /* uint16_t[] */
+   uint32_t devclass, devnum;           /* uint8_t[]  */
+   uint32_t busname, filename;          /* uint32_t[] string offsets */
+   uint32_t manufacturer, product;
+   uint32_t serial, driver;
+   uint32_t str;                        /* char[strsize] */
+};
+
+/* Read-only view of a mapped snapshot, no per-device allocations. */
+struct usb_snap
+{
+   void   *map;
+   size_t  size;
+   int     count;
+
+   const uint16_t *vid, *pid, *bcd, *bcdusb;
+   const uint8_t  *devclass, *devnum;
+   const uint32_t *busname, *filename;
+   const uint32_t *manufacturer, *product;
+   const uint32_t *serial, *driver;
+   const char     *str;
+};
+
+#define usb_snap_str(snap, field, i)  ((snap)->str + (snap)->field[i])
+
+int  usb_snap_write (const char *file, struct usb_device *list, int jobs);
+int  usb_snap_open  (const char *file, struct usb_snap *snap);
+void usb_snap_close (struct usb_snap *snap);
+
+#endif /* _USBSNAP_H */
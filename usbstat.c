@@ -0,0 +1,177 @@
+/* usbstat.c  --  Timing and latency statistics helpers.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "usbstat.h"
+
+#define HIST_WIDTH 40
+
+void usb_stat_init (struct usb_stat *st)
+{
+   memset (st, 0, sizeof (*st));
+}
+
+void usb_stat_free (struct usb_stat *st)
+{
+   free (st->val);
+   usb_stat_init (st);
+}
+
+int usb_stat_add (struct usb_stat *st, double val)
+{
+   if (st->num == st->size)
+   {
+      double *tmp;
+      int size = st->size ? st->size * 2 : 1024;
+
+      tmp = realloc (st->val, size * sizeof (double));
+      if (!tmp)
+         return -1;
+      st->val  = tmp;
+      st->size = size;
+   }
+
+   if (!st->num || val < st->min)
+      st->min = val;
+   if (!st->num || val > st->max)
+      st->max = val;
+   st->sum   += val;
+   st->sumsq += val * val;
+   st->val[st->num++] = val;
+   st->sorted = 0;
+
+   return 0;
+}
+
+double usb_stat_mean (struct usb_stat *st)
+{
+   return st->num ? st->sum / st->num : 0;
+}
+
+double usb_stat_stddev (struct usb_stat *st)
+{
+   double mean = usb_stat_mean (st), var;
+
+   if (st->num < 2)
+      return 0;
+
+   var = st->sumsq / st->num - mean * mean;
+
+   return var > 0 ? sqrt (var) : 0;
+}
+
+static int stat_cmp (const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+
+   return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile, pct in 0..100 */
+double usb_stat_pct (struct usb_stat *st, double pct)
+{
+   int rank;
+
+   if (!st->num)
+      return 0;
+
+   if (!st->sorted)
+   {
+      qsort (st->val, st->num, sizeof (double), stat_cmp);
+      st->sorted = 1;
+   }
+
+   rank = (int)ceil (pct / 100.0 * st->num) - 1;
+   if (rank < 0)
+      rank = 0;
+   if (rank >= st->num)
+      rank = st->num - 1;
+
+   return st->val[rank];
+}
+
+void usb_stat_print (FILE *fp, struct usb_stat *st, const char *unit)
+{
+   fprintf (fp, "min %.3f avg %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f %s",
+            st->min, usb_stat_mean (st), usb_stat_pct (st, 50),
+            usb_stat_pct (st, 90), usb_stat_pct (st, 99), st->max, unit);
+}
+
+/* Power of two buckets, empty buckets at either end are left out. */
+void usb_stat_histogram (FILE *fp, struct usb_stat *st, const char *unit)
+{
+   int bucket[64], i, b, first = 64, last = -1, peak = 0;
+
+   memset (bucket, 0, sizeof (bucket));
+   for (i = 0; i < st->num; i++)
+   {
+      b = st->val[i] < 1 ? 0 : (int)log2 (st->val[i]) + 1;
+      if (b > 63)
+         b = 63;
+      bucket[b]++;
+      if (b < first)
+         first = b;
+      if (b > last)
+         last = b;
+   }
+
+   for (b = first; b <= last; b++)
+   {
+      if (bucket[b] > peak)
+         peak = bucket[b];
+   }
+
+   for (b = first; b <= last; b++)
+   {
+      fprintf (fp, "    [%8.0f, %8.0f) %s %8d %.*s\n",
+               b ? ldexp (1, b - 1) : 0, ldexp (1, b), unit, bucket[b],
+               peak ? bucket[b] * HIST_WIDTH / peak : 0,
+               "########################################");
+   }
+}
+
+double usb_diff_us (const struct timespec *start, const struct timespec *end)
+{
+   return (end->tv_sec - start->tv_sec) * 1000000.0
+      + (end->tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+double usb_elapsed_ms (const struct timespec *start)
+{
+   struct timespec now;
+
+   clock_gettime (CLOCK_MONOTONIC, &now);
+
+   return usb_diff_us (start, &now) / 1000.0;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,48 @@
+/* usbstat.h  --  Timing and latency statistics helpers.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBSTAT_H
+#define _USBSTAT_H
+
+#include <stdio.h>
+#include <time.h>
+
+/* Collects samples, percentiles sort them in place on demand. */
+struct usb_stat
+{
+   double *val;
+   int     num, size;
+   int     sorted;
+   double  min, max, sum, sumsq;
+};
+
+void   usb_stat_init (struct usb_stat *st);
+void   usb_stat_free (struct usb_stat *st);
+int    usb_stat_add  (struct usb_stat *st, double val);
+double usb_stat_mean (struct usb_stat *st);
+double usb_stat_stddev (struct usb_stat *st);
+double usb_stat_pct  (struct usb_stat *st, double pct);
+void   usb_stat_print (FILE *fp, struct usb_stat *st, const char *unit);
+void   usb_stat_histogram (FILE *fp, struct usb_stat *st, const char *unit);
+
+double usb_elapsed_ms (const struct timespec *start);
+double usb_diff_us (const struct timespec *start, const struct timespec *end);
+
+#endif /* _USBSTAT_H */
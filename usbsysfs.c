@@ -0,0 +1,416 @@
+/* usbsysfs.c  --  Map libusb devices to their sysfs nodes.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "error.h"
+#include "usbdesc.h"
+#include "usbmisc.h"
+#include "usbsysfs.h"
+
+extern int usb_debug;
+
+/* Device directories already known, by bus and device number */
+struct sysfs_node
+{
+   int busnum;
+   int devnum;
+   char name[32];
+};
+
+static struct sysfs_node *nodes;
+static int nnodes;
+static pthread_mutex_t nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sysfs_lookup (int busnum, int devnum, char *path, size_t len)
+{
+   int i, result = -ENOENT;
+
+   pthread_mutex_lock (&nodes_lock);
+   for (i = 0; i < nnodes; i++)
+   {
+      if (nodes[i].busnum == busnum && nodes[i].devnum == devnum)
+      {
+         snprintf (path, len, "%s/%s", PATH_SYSFS_USB, nodes[i].name);
+         result = 0;
+         break;
+      }
+   }
+   pthread_mutex_unlock (&nodes_lock);
+
+   return result;
+}
+
+static void sysfs_remember (int busnum, int devnum, const char *name)
+{
+   struct sysfs_node *node;
+   int i;
+
+   if (strlen (name) >= sizeof (node->name))
+      return;
+
+   pthread_mutex_lock (&nodes_lock);
+   for (i = 0; i < nnodes; i++)
+   {
+      if (nodes[i].busnum == busnum && nodes[i].devnum == devnum)
+         break;
+   }
+   if (i == nnodes)
+   {
+      node = realloc (nodes, (nnodes + 1) * sizeof (*node));
+      if (node)
+      {
+         nodes = node;
+         nnodes++;
+      }
+   }
+   if (i < nnodes)
+   {
+      nodes[i].busnum = busnum;
+      nodes[i].devnum = devnum;
+      strcpy (nodes[i].name, name);
+   }
+   pthread_mutex_unlock (&nodes_lock);
+}
+
+/* Tell usb_sysfs_path() where dev lives when the caller already knows,
+ * e.g. a device opened through its sysfs directory. */
+void usb_sysfs_remember (struct usb_device *dev, const char *path)
+{
+   char name[PATH_MAX + 1], *p;
+
+   snprintf (name, sizeof (name), "%s", path);
+   for (p = name + strlen (name); p > name && p[-1] == '/'; )
+      *--p = 0;
+   p = strrchr (name, '/');
+
+   sysfs_remember (atoi (dev->bus->dirname), dev->devnum, p ? p + 1 : name);
+}
+
+/* Find the sysfs directory of dev, e.g. /sys/bus/usb/devices/1-1.2,
+ * by matching bus and device number.  Interface nodes are skipped.
+ * One scan records every device it passes, so listing a whole bus
+ * reads sysfs once, and again only for a device it has not seen. */
+int usb_sysfs_path (struct usb_device *dev, char *path, size_t len)
+{
+   static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+   DIR *dir;
+   struct dirent *d;
+   char buf[16];
+   int busnum, devnum;
+
+   busnum = atoi (dev->bus->dirname);
+   devnum = dev->devnum;
+   if (!sysfs_lookup (busnum, devnum, path, len))
+      return 0;
+
+   /* Another worker may have scanned while we waited */
+   pthread_mutex_lock (&scan_lock);
+   if (!sysfs_lookup (busnum, devnum, path, len))
+   {
+      pthread_mutex_unlock (&scan_lock);
+      return 0;
+   }
+
+   dir = opendir (PATH_SYSFS_USB);
+   if (!dir)
+   {
+      pthread_mutex_unlock (&scan_lock);
+      USB_ERROR_STR(-errno, "could not open %s: %s", PATH_SYSFS_USB, strerror(errno));
+   }
+
+   while ((d = readdir (dir)))
+   {
+      int b, n;
+
+      if (d->d_name[0] == '.' || strchr (d->d_name, ':'))
+         continue;
+
+      snprintf (path, len, "%s/%s", PATH_SYSFS_USB, d->d_name);
+      if (usb_sysfs_read (path, "busnum", buf, sizeof (buf)))
+         continue;
+      b = atoi (buf);
+      if (usb_sysfs_read (path, "devnum", buf, sizeof (buf)))
+         continue;
+      n = atoi (buf);
+
+      sysfs_remember (b, n, d->d_name);
+   }
+   closedir (dir);
+   pthread_mutex_unlock (&scan_lock);
+
+   if (!sysfs_lookup (busnum, devnum, path, len))
+      return 0;
+
+   USB_ERROR_STR(-ENODEV, "no sysfs node for device %s/%s",
+                 dev->bus->dirname, dev->filename);
+}
+
+/* Read a single line attribute, trailing newline stripped. */
+int usb_sysfs_read (const char *path, const char *attr, char *buf, size_t len)
+{
+   char file[PATH_MAX + 1];
+   ssize_t num;
+   int fd;
+
+   snprintf (file, sizeof (file), "%s/%s", path, attr);
+   fd = open (file, O_RDONLY);
+   if (fd < 0)
+      return -errno;
+
+   num = read (fd, buf, len - 1);
+   close (fd);
+   if (num < 0)
+      return -errno;
+
+   while (num > 0 && (buf[num - 1] == '\n' || buf[num - 1] == ' '))
+      num--;
+   buf[num] = 0;
+
+   return 0;
+}
+
+int usb_sysfs_write (const char *path, const char *attr, const char *value)
+{
+   char file[PATH_MAX + 1];
+   ssize_t num;
+   int fd;
+
+   snprintf (file, sizeof (file), "%s/%s", path, attr);
+   fd = open (file, O_WRONLY);
+   if (fd < 0)
+   {
+      USB_ERROR_STR(-errno, "could not open %s: %s", file, strerror(errno));
+   }
+
+   num = write (fd, value, strlen (value));
+   close (fd);
+   if (num < 0)
+   {
+      USB_ERROR_STR(-errno, "could not write %s to %s: %s", value, file, strerror(errno));
+   }
+
+   return 0;
+}
+
+/* Child device node on a hub port: usb1 port 2 is 1-2, 1-1 port 3 is
+ * 1-1.3.  Returns 0 if a device is enumerated there, -ENOENT if not. */
+int usb_sysfs_port_child (const char *hub, int port, char *path, size_t len)
+{
+   const char *name = strrchr (hub, '/');
+
+   name = name ? name + 1 : hub;
+   if (!strncmp (name, "usb", 3))
+      snprintf (path, len, "%s/%s-%d", PATH_SYSFS_USB, name + 3, port);
+   else
+      snprintf (path, len, "%s/%s.%d", PATH_SYSFS_USB, name, port);
+
+   return access (path, F_OK) ? -errno : 0;
+}
+
+/* Upstream hub of a device node and the port it is attached to, the
+ * reverse of usb_sysfs_port_child().  Root hubs have no parent. */
+int usb_sysfs_parent (const char *path, char *parent, size_t len, int *port)
+{
+   const char *name = strrchr (path, '/');
+   const char *sep;
+
+   name = name ? name + 1 : path;
+   if (!strncmp (name, "usb", 3))
+      return -ENOENT;
+
+   sep = strrchr (name, '.');
+   if (sep)
+      snprintf (parent, len, "%s/%.*s", PATH_SYSFS_USB, (int)(sep - name), name);
+   else if ((sep = strchr (name, '-')))
+      snprintf (parent, len, "%s/usb%.*s", PATH_SYSFS_USB, (int)(sep - name), name);
+   else
+      return -EINVAL;
+
+   if (port)
+      *port = atoi (sep + 1);
+
+   return 0;
+}
+
+/* The hub port a device is attached to, e.g. 1-1.2 is on
+ * 1-1/1-1:1.0/1-1-port2 and 1-3 on usb1/1-0:1.0/usb1-port3. */
+int usb_sysfs_port (const char *path, char *port, size_t len)
+{
+   char parent[PATH_MAX + 1];
+   const char *name;
+   int num;
+
+   if (usb_sysfs_parent (path, parent, sizeof (parent), &num))
+   {
+      USB_ERROR_STR(-ENOENT, "%s is a root hub, it has no port", path);
+   }
+
+   name = strrchr (parent, '/') + 1;
+   if (!strncmp (name, "usb", 3))
+      snprintf (port, len, "%s/%s-0:1.0/%s-port%d", parent, name + 3, name, num);
+   else
+      snprintf (port, len, "%s/%s:1.0/%s-port%d", parent, name, name, num);
+
+   if (access (port, F_OK))
+   {
+      USB_ERROR_STR(-errno, "no hub port %s: %s", port, strerror(errno));
+   }
+
+   return 0;
+}
+
+/* The other half of a USB 3 port, through the port's peer link: the
+ * hub directory and port number the device would show up on at the
+ * other speed. */
+int usb_sysfs_port_peer (const char *path, char *hub, size_t len, int *port)
+{
+   char link[PATH_MAX + 1], real[PATH_MAX + 1];
+   char *sep;
+
+   if (usb_sysfs_port (path, link, sizeof (link) - 5))
+      return -ENOENT;
+   strcat (link, "/peer");
+   if (!realpath (link, real))
+      return -errno;
+
+   /* .../usb2/2-0:1.0/usb2-port1 */
+   sep = strstr (strrchr (real, '/'), "-port");
+   if (!sep)
+      return -EINVAL;
+   *port = atoi (sep + 5);
+   *strrchr (real, '/') = 0;
+   *strrchr (real, '/') = 0;
+   snprintf (hub, len, "%s", real);
+
+   return 0;
+}
+
+int usb_sysfs_speed (const char *path)
+{
+   char buf[16];
+
+   if (usb_sysfs_read (path, "speed", buf, sizeof (buf)))
+      return USB_SPEED_UNKNOWN;
+
+   return atoi (buf);
+}
+
+/* Periodic bandwidth reserved by the active settings of one device */
+static double periodic_used (const char *path, struct usb_device *other)
+{
+   struct usb_config_descriptor *config;
+   struct usb_interface *intf;
+   char file[PATH_MAX + 1], buf[16];
+   double sum = 0;
+   int c, i, a, cfg, alt, speed;
+
+   if (usb_sysfs_read (path, "bConfigurationValue", buf, sizeof (buf)) || !other->config)
+      return 0;
+
+   cfg   = atoi (buf);
+   speed = usb_sysfs_speed (path);
+   for (c = 0; c < other->descriptor.bNumConfigurations; c++)
+   {
+      config = &other->config[c];
+      if (config->bConfigurationValue != cfg)
+         continue;
+
+      for (i = 0; i < config->bNumInterfaces; i++)
+      {
+         intf = &config->interface[i];
+         if (!intf->num_altsetting)
+            continue;
+
+         snprintf (file, sizeof (file), "%s:%d.%d", path, cfg,
+                   intf->altsetting[0].bInterfaceNumber);
+         if (usb_sysfs_read (file, "bAlternateSetting", buf, sizeof (buf)))
+            continue;
+
+         alt = atoi (buf);
+         for (a = 0; a < intf->num_altsetting; a++)
+         {
+            if (intf->altsetting[a].bAlternateSetting == alt)
+               sum += usb_altsetting_bandwidth (&intf->altsetting[a], speed);
+         }
+      }
+   }
+
+   return sum;
+}
+
+/* Periodic bandwidth, in bytes per second, reserved by the active
+ * alternate settings of every other device on dev's bus.  The bus is
+ * walked in sysfs, libusb may only know dev itself.  Devices behind a
+ * transaction translator are counted at their own payload rate, which
+ * leaves out the split transaction overhead. */
+double usb_sysfs_periodic_used (struct usb_device *dev)
+{
+   struct usb_device *other;
+   struct dirent *d;
+   DIR *dir;
+   char path[PATH_MAX + 1], buf[16];
+   double sum = 0;
+   int busnum;
+
+   busnum = atoi (dev->bus->dirname);
+   dir = opendir (PATH_SYSFS_USB);
+   if (!dir)
+      return 0;
+
+   while ((d = readdir (dir)))
+   {
+      if (d->d_name[0] == '.' || strchr (d->d_name, ':'))
+         continue;
+
+      snprintf (path, sizeof (path), "%s/%s", PATH_SYSFS_USB, d->d_name);
+      if (usb_sysfs_read (path, "busnum", buf, sizeof (buf)) || atoi (buf) != busnum)
+         continue;
+      if (usb_sysfs_read (path, "devnum", buf, sizeof (buf)) || atoi (buf) == dev->devnum)
+         continue;
+
+      other = get_usb_device_direct (path);
+      if (!other)
+         continue;
+      sum += periodic_used (path, other);
+      free_usb_device (other);
+   }
+   closedir (dir);
+
+   return sum;
+}
+
+/**
+ * Local Variables:
+ *  c-file-style: "ellemtel"
+ *  indent-tabs-mode: nil
+ * End:
+ */
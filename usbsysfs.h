@@ -0,0 +1,47 @@
+/* usbsysfs.h  --  Map libusb devices to their sysfs nodes.
+ *
+ * Copyright (C) 2005  Joachim Nilsson <jocke()vmlinux!org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _USBSYSFS_H
+#define _USBSYSFS_H
+
+#include <usb.h>
+
+#define PATH_SYSFS_USB "/sys/bus/usb/devices"
+
+/* Negotiated speed in Mbit/s, low speed is 1.5 but reported as 1 */
+#define USB_SPEED_UNKNOWN   0
+#define USB_SPEED_LOW       1
+#define USB_SPEED_FULL      12
+#define USB_SPEED_HIGH      480
+#define USB_SPEED_SUPER     5000
+#define USB_SPEED_SUPER_PLUS 10000
+
+int usb_sysfs_path (struct usb_device *dev, char *path, size_t len);
+void usb_sysfs_remember (struct usb_device *dev, const char *path);
+int usb_sysfs_read (const char *path, const char *attr, char *buf, size_t len);
+int usb_sysfs_write (const char *path, const char *attr, const char *value);
+int usb_sysfs_port_child (const char *hub, int port, char *path, size_t len);
+int usb_sysfs_parent (const char *path, char *parent, size_t len, int *port);
+int usb_sysfs_port (const char *path, char *port, size_t len);
+int usb_sysfs_port_peer (const char *path, char *hub, size_t len, int *port);
+int usb_sysfs_speed (const char *path);
+double usb_sysfs_periodic_used (struct usb_device *dev);
+
+#endif /* _USBSYSFS_H */